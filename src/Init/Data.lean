@@ -33,5 +33,7 @@ import Init.Data.Prod
 import Init.Data.AC
 import Init.Data.Queue
 import Init.Data.Channel
+import Init.Data.ConcurrentHashMap
+import Init.Data.StringBuilder
 import Init.Data.Cast
 import Init.Data.Sum
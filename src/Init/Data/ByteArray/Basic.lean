@@ -112,6 +112,14 @@ def toList (bs : ByteArray) : List UInt8 :=
     decreasing_by decreasing_trivial_pre_omega
   loop start
 
+/--
+Returns the index of the first occurrence of `b` in `a` at or after `start`, if any.
+Unlike `findIdx?`, it is implemented by a single `memchr` call in the runtime.
+-/
+@[extern "lean_byte_array_index_of"]
+def indexOf? (a : @& ByteArray) (b : UInt8) (start : @& Nat := 0) : Option Nat :=
+  a.findIdx? (· == b) start
+
 /--
   We claim this unsafe implementation is correct because an array cannot have more than `usizeSz` elements in our runtime.
   This is similar to the `Array` version.
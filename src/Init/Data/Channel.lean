@@ -133,3 +133,80 @@ private partial def Channel.Sync.forIn [Monad m] [MonadLiftT BaseIO m]
 /-- `for msg in ch.sync do ...` receives all messages in the channel until it is closed. -/
 instance [MonadLiftT BaseIO m] : ForIn m (Channel.Sync α) α where
   forIn ch b f := ch.forIn f b
+
+private opaque NativeChannelPointed : NonemptyType.{0}
+
+/--
+FIFO channel implemented natively by the runtime, where `recv?` returns a `Task`.
+
+Unlike `Channel`, which serializes all operations on a mutex, sending to and trying to receive
+from a bounded `NativeChannel` are lock-free, and an unbounded one uses separate locks for senders
+and receivers. A channel can be closed. Once it is closed, all `send`s are ignored, and `recv?`
+returns `none` once the queue is empty.
+-/
+def NativeChannel (_ : Type) : Type := NativeChannelPointed.type
+
+instance : Nonempty (NativeChannel α) := NativeChannelPointed.property
+
+/--
+Creates a new `NativeChannel`. If `capacity` is given, the channel holds at most `capacity`
+messages, rounded up to a power of two, and sending to it waits while it is full.
+-/
+@[extern "lean_io_native_channel_new"]
+opaque NativeChannel.new (capacity : @& Option Nat := none) : BaseIO (NativeChannel α)
+
+/--
+Sends a message on a `NativeChannel`.
+
+This function only blocks if the channel is bounded and full.
+-/
+@[extern "lean_io_native_channel_send"]
+opaque NativeChannel.send (ch : @& NativeChannel α) (v : α) : BaseIO Unit
+
+/--
+Sends a message on a `NativeChannel` without blocking.
+Returns `false` if the channel is closed or full.
+-/
+@[extern "lean_io_native_channel_try_send"]
+opaque NativeChannel.trySend (ch : @& NativeChannel α) (v : α) : BaseIO Bool
+
+/-- Closes a `NativeChannel`. -/
+@[extern "lean_io_native_channel_close"]
+opaque NativeChannel.close (ch : @& NativeChannel α) : BaseIO Unit
+
+/--
+Receives a message, without blocking.
+The returned task waits for the message.
+Every message is only received once.
+
+Returns `none` if the channel is closed and the queue is empty.
+-/
+@[extern "lean_io_native_channel_recv"]
+opaque NativeChannel.recv? (ch : @& NativeChannel α) : BaseIO (Task (Option α))
+
+/-- Receives a message if one is queued, without blocking or creating a task. -/
+@[extern "lean_io_native_channel_try_recv"]
+opaque NativeChannel.tryRecv? (ch : @& NativeChannel α) : BaseIO (Option α)
+
+/--
+`ch.forAsync f` calls `f` for every messages received on `ch`.
+
+Note that if this function is called twice, each `forAsync` only gets half the messages.
+-/
+partial def NativeChannel.forAsync (f : α → BaseIO Unit) (ch : NativeChannel α)
+    (prio : Task.Priority := .default) : BaseIO (Task Unit) := do
+  BaseIO.bindTask (prio := prio) (← ch.recv?) fun
+    | none => return .pure ()
+    | some v => do f v; ch.forAsync f prio
+
+/--
+Synchronously receives a message from the channel.
+
+Every message is only received once.
+Returns `none` if the channel is closed and the queue is empty.
+This function should only be used in dedicated threads.
+-/
+def NativeChannel.recvSync? (ch : NativeChannel α) : BaseIO (Option α) := do
+  if let some v ← ch.tryRecv? then
+    return some v
+  IO.wait (← ch.recv?)
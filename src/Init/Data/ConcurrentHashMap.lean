@@ -0,0 +1,69 @@
+/-
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+-/
+prelude
+import Init.System.IO
+import Init.Data.Hashable
+
+namespace IO
+
+private opaque ConcurrentHashMapPointed : NonemptyType.{0}
+
+/--
+Hash map implemented natively by the runtime that can be shared and updated by multiple threads,
+e.g. to implement caches shared by tasks.
+
+Entries are distributed by their hash over independently locked shards, so that concurrent
+accesses to different keys rarely wait for each other, and no update is lost under races unlike
+with `take`/`set` pairs on an `IO.Ref (HashMap α β)`.
+-/
+def ConcurrentHashMap (_ _ : Type) : Type := ConcurrentHashMapPointed.type
+
+instance : Nonempty (ConcurrentHashMap α β) := ConcurrentHashMapPointed.property
+
+/--
+Creates a new `ConcurrentHashMap` using the given hash and equality functions.
+`beq` is called while holding a lock and must not access the map.
+-/
+@[extern "lean_io_concurrent_hash_map_new"]
+opaque ConcurrentHashMap.mkCore (hash : α → UInt64) (beq : α → α → Bool) : BaseIO (ConcurrentHashMap α β)
+
+/-- Creates a new `ConcurrentHashMap`. -/
+@[inline] def ConcurrentHashMap.new [Hashable α] [BEq α] : BaseIO (ConcurrentHashMap α β) :=
+  ConcurrentHashMap.mkCore hash (· == ·)
+
+/-- Returns the value of `k`, if any. -/
+@[extern "lean_io_concurrent_hash_map_get"]
+opaque ConcurrentHashMap.get? (m : @& ConcurrentHashMap α β) (k : @& α) : BaseIO (Option β)
+
+/-- Sets the value of `k` to `v`, replacing any previous value. -/
+@[extern "lean_io_concurrent_hash_map_insert"]
+opaque ConcurrentHashMap.insert (m : @& ConcurrentHashMap α β) (k : α) (v : β) : BaseIO Unit
+
+/--
+Sets the value of `k` to `v` unless `k` already has a value. Returns the value of `k` after the
+operation, i.e. the value that was inserted first when racing with other threads.
+-/
+@[extern "lean_io_concurrent_hash_map_insert_if_absent"]
+opaque ConcurrentHashMap.insertIfAbsent (m : @& ConcurrentHashMap α β) (k : α) (v : β) : BaseIO β :=
+  pure v
+
+/-- Removes the value of `k`, if any. -/
+@[extern "lean_io_concurrent_hash_map_erase"]
+opaque ConcurrentHashMap.erase (m : @& ConcurrentHashMap α β) (k : @& α) : BaseIO Unit
+
+/-- Returns the number of entries in the map. -/
+@[extern "lean_io_concurrent_hash_map_size"]
+opaque ConcurrentHashMap.size (m : @& ConcurrentHashMap α β) : BaseIO Nat
+
+/--
+Returns the value of `k`, computing and inserting it using `f` if there is none. If multiple
+threads compute the value of the same key concurrently, all of them return the value inserted
+first.
+-/
+@[inline] def ConcurrentHashMap.getOrInsertWith (m : ConcurrentHashMap α β) (k : α) (f : Unit → β) :
+    BaseIO β := do
+  if let some v ← m.get? k then
+    return v
+  m.insertIfAbsent k (f ())
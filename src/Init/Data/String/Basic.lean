@@ -800,7 +800,52 @@ where
 def isPrefixOf (p : String) (s : String) : Bool :=
   substrEq p 0 s 0 p.endPos.byteIdx
 
+/--
+Returns the position of the first occurrence of `pattern` in `s` at or after `start`, or `s.endPos`
+if there is none. Returns `start` if `pattern` is empty. `start` should be a valid position of `s`.
+
+Examples:
+* `"abcabc".findStr "bc" = ⟨1⟩`
+* `"abcabc".findStr "bc" ⟨2⟩ = ⟨4⟩`
+* `"abcabc".findStr "cb" = ⟨6⟩`
+-/
+@[extern "lean_string_find"]
+def findStr (s : @& String) (pattern : @& String) (start : @& Pos := 0) : Pos :=
+  if h : pattern.endPos.1 = 0 then start
+  else
+    have hPatt := Nat.zero_lt_of_ne_zero h
+    let rec loop (pos : String.Pos) :=
+      if h : pos.byteIdx + pattern.endPos.byteIdx > s.endPos.byteIdx then
+        s.endPos
+      else
+        have := Nat.lt_of_lt_of_le (Nat.add_lt_add_left hPatt _) (Nat.ge_of_not_lt h)
+        if s.substrEq pos pattern 0 pattern.endPos.byteIdx then
+          pos
+        else
+          have := Nat.sub_lt_sub_left this (lt_next s pos)
+          loop (s.next pos)
+      termination_by s.endPos.1 - pos.1
+    loop start
+
+/-- Returns the number of occurrences of the character `c` in `s`. -/
+@[extern "lean_string_count_char"]
+def countChar (s : @& String) (c : Char) : Nat :=
+  s.foldl (fun n d => if d == c then n + 1 else n) 0
+
+private partial def replaceFastLoop (s pattern replacement acc : String) (pos : Pos) : String :=
+  let p := s.findStr pattern pos
+  if p == s.endPos then
+    acc ++ s.extract pos s.endPos
+  else
+    replaceFastLoop s pattern replacement (acc ++ s.extract pos p ++ replacement) (p + pattern)
+
+/-- Implementation of `replace` that searches for `pattern` using the runtime's `findStr`. -/
+private def replaceFast (s pattern replacement : String) : String :=
+  if pattern.endPos.1 = 0 then s
+  else replaceFastLoop s pattern replacement "" 0
+
 /-- Replace all occurrences of `pattern` in `s` with `replacement`. -/
+@[implemented_by replaceFast]
 def replace (s pattern replacement : String) : String :=
   if h : pattern.endPos.1 = 0 then s
   else
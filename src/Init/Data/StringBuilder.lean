@@ -0,0 +1,53 @@
+/-
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+-/
+prelude
+import Init.System.IO
+
+namespace IO
+
+private opaque StringBuilderPointed : NonemptyType.{0}
+
+/--
+Mutable buffer for building a large string out of many pieces, implemented natively by the runtime.
+
+Appending to a `StringBuilder` takes amortized constant time even if the appended string is
+shared, while `String.append` has to copy its first argument unless it is uniquely referenced.
+Short strings are copied into the builder and long ones are shared. The result is only flattened
+into a single string by `toString`, or written to a file piece by piece by `writeTo`.
+-/
+def StringBuilder : Type := StringBuilderPointed.type
+
+instance : Nonempty StringBuilder := StringBuilderPointed.property
+
+/-- Creates a new, empty `StringBuilder`. -/
+@[extern "lean_io_string_builder_new"]
+opaque StringBuilder.new : BaseIO StringBuilder
+
+/-- Appends `s` to the builder. -/
+@[extern "lean_io_string_builder_append"]
+opaque StringBuilder.append (b : @& StringBuilder) (s : @& String) : BaseIO Unit
+
+/-- Appends the character `c` to the builder. -/
+@[extern "lean_io_string_builder_push"]
+opaque StringBuilder.push (b : @& StringBuilder) (c : Char) : BaseIO Unit
+
+/-- Returns the size in bytes of the UTF-8 encoding of the contents of the builder. -/
+@[extern "lean_io_string_builder_size"]
+opaque StringBuilder.size (b : @& StringBuilder) : BaseIO Nat
+
+/-- Returns the number of characters in the builder. -/
+@[extern "lean_io_string_builder_length"]
+opaque StringBuilder.length (b : @& StringBuilder) : BaseIO Nat
+
+/--
+Returns the contents of the builder. The builder keeps the result, so calling `toString` again
+without appending to the builder in between does not copy the contents again.
+-/
+@[extern "lean_io_string_builder_to_string"]
+opaque StringBuilder.toString (b : @& StringBuilder) : BaseIO String
+
+/-- Writes the contents of the builder to `h` without flattening them into a single string. -/
+@[extern "lean_io_string_builder_write_to"]
+opaque StringBuilder.writeTo (b : @& StringBuilder) (h : @& FS.Handle) : IO Unit
@@ -100,6 +100,21 @@ set_option compiler.extract_closed false in
    The action `initializing` returns `true` iff it is invoked during initialization. -/
 @[extern "lean_io_initializing"] opaque IO.initializing : BaseIO Bool
 
+set_option linter.unusedVariables.funArgs false in
+/--
+`Task.mapList f tasks` constructs (and immediately launches) a task that waits for all `tasks` and
+then calls `f` on the list of their values. Unlike chaining `tasks.length` `bind`s, it is
+implemented by a single task in the runtime that waits for the given tasks in order, so its
+overhead is linear in the number of tasks.
+
+`prio`, if provided, is the priority of the task.
+If `sync` is set to true, `f` is executed on the current thread if all `tasks` have already finished.
+-/
+@[noinline, extern "lean_task_map_list"]
+protected def Task.mapList (f : List α → β) (tasks : List (Task α)) (prio := Task.Priority.default)
+    (sync := false) : Task β :=
+  ⟨f (tasks.map Task.get)⟩
+
 namespace BaseIO
 
 /--
@@ -126,6 +141,8 @@ opaque bindTask (t : Task α) (f : α → BaseIO (Task β)) (prio := Task.Priori
     (sync := false) : BaseIO (Task β) :=
   f t.get
 
+/-- See `BaseIO.asTask` and `Task.mapList`. -/
+@[extern "lean_io_map_tasks"]
 def mapTasks (f : List α → BaseIO β) (tasks : List (Task α)) (prio := Task.Priority.default)
     (sync := false) : BaseIO (Task β) :=
   go tasks []
@@ -185,6 +202,15 @@ def sleep (ms : UInt32) : BaseIO Unit :=
   -- TODO: add a proper primitive for IO.sleep
   fun s => dbgSleep ms fun _ => EStateM.Result.ok () s
 
+/--
+Returns a task that finishes after `ms` milliseconds. Unlike running `IO.sleep` in a task, pending
+timers do not occupy any threads of the task manager.
+-/
+@[extern "lean_io_sleep_task"]
+opaque sleepTask (ms : UInt32) : BaseIO (Task Unit) := do
+  sleep ms
+  return .pure ()
+
 /-- `IO` specialization of `EIO.asTask`. -/
 @[inline] def asTask (act : IO α) (prio := Task.Priority.default) : BaseIO (Task (Except IO.Error α)) :=
   EIO.asTask act prio
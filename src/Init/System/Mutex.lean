@@ -65,6 +65,41 @@ opaque Condvar.notifyOne (condvar : @& Condvar) : BaseIO Unit
 @[extern "lean_io_condvar_notify_all"]
 opaque Condvar.notifyAll (condvar : @& Condvar) : BaseIO Unit
 
+private opaque AtomicCounterImpl : NonemptyType.{0}
+
+/--
+A 64-bit counter that can be read and updated by multiple threads without locking.
+
+Unlike an `IO.Ref UInt64`, updating it does not allocate or wait for other threads.
+-/
+def AtomicCounter : Type := AtomicCounterImpl.type
+
+instance : Nonempty AtomicCounter := AtomicCounterImpl.property
+
+/-- Creates a new atomic counter with initial value `v`. -/
+@[extern "lean_io_atomic_counter_new"]
+opaque AtomicCounter.new (v : UInt64 := 0) : BaseIO AtomicCounter
+
+/-- Reads the value of the counter. -/
+@[extern "lean_io_atomic_counter_get"]
+opaque AtomicCounter.get (c : @& AtomicCounter) : BaseIO UInt64
+
+/-- Sets the value of the counter. -/
+@[extern "lean_io_atomic_counter_set"]
+opaque AtomicCounter.set (c : @& AtomicCounter) (v : UInt64) : BaseIO Unit
+
+/-- Adds `d` to the counter, wrapping around on overflow, and returns its previous value. -/
+@[extern "lean_io_atomic_counter_fetch_add"]
+opaque AtomicCounter.fetchAdd (c : @& AtomicCounter) (d : UInt64) : BaseIO UInt64
+
+/-- Sets the value of the counter to `desired` if it is `expected`, returning whether it was set. -/
+@[extern "lean_io_atomic_counter_cas"]
+opaque AtomicCounter.compareAndSet (c : @& AtomicCounter) (expected desired : UInt64) : BaseIO Bool
+
+/-- Increments the counter and returns its new value as a `Nat`. -/
+def AtomicCounter.incr (c : AtomicCounter) : BaseIO Nat :=
+  return ((← c.fetchAdd 1) + 1).toNat
+
 /-- Waits on the condition variable until the predicate is true. -/
 def Condvar.waitUntil [Monad m] [MonadLift BaseIO m]
     (condvar : Condvar) (mutex : BaseMutex) (pred : m Bool) : m Unit := do
@@ -94,6 +94,24 @@ def Ref.modifyGet {σ α β : Type} (r : Ref σ α) (f : α → β × α) : ST 
   Ref.set r a
   pure b
 
+/--
+Replaces the value of the reference with `desired` if it is pointer-equal to `expected`, returning
+whether it was replaced. Unlike a `take`/`set` pair, this never leaves the reference empty, so other
+threads accessing it do not have to wait.
+-/
+@[extern "lean_st_ref_cas"]
+opaque Ref.compareAndSet {σ α} (r : @& Ref σ α) (expected : @& α) (desired : α) : ST σ Bool
+
+/--
+Like `Ref.modifyGet`, but applies `f` to the current value without taking it out of the reference,
+and publishes the result using `Ref.compareAndSet`, reapplying `f` to the new value if another
+thread modified the reference in the meantime. Other threads thus do not wait on the reference while
+`f` is evaluated, but it may be evaluated multiple times and its argument is shared.
+-/
+@[extern "lean_st_ref_modify_get_lock_free"]
+opaque Ref.modifyGetLockFree {σ α β : Type} (r : @& Ref σ α) (f : α → β × α) : ST σ β :=
+  Ref.modifyGet r f
+
 end Prim
 
 section
@@ -107,6 +125,8 @@ variable {σ : Type} {m : Type → Type} [Monad m] [MonadLiftT (ST σ) m]
 @[inline] def Ref.ptrEq {α : Type} (r1 r2 : Ref σ α) : m Bool := liftM <| Prim.Ref.ptrEq r1 r2
 @[inline] def Ref.modify {α : Type} (r : Ref σ α) (f : α → α) : m Unit := liftM <| Prim.Ref.modify r f
 @[inline] def Ref.modifyGet {α : Type} {β : Type} (r : Ref σ α) (f : α → β × α) : m β := liftM <| Prim.Ref.modifyGet r f
+@[inline] def Ref.compareAndSet {α : Type} (r : Ref σ α) (expected desired : α) : m Bool := liftM <| Prim.Ref.compareAndSet r expected desired
+@[inline] def Ref.modifyGetLockFree {α : Type} {β : Type} (r : Ref σ α) (f : α → β × α) : m β := liftM <| Prim.Ref.modifyGetLockFree r f
 
 def Ref.toMonadStateOf (r : Ref σ α) : MonadStateOf α m where
   get := r.get
@@ -195,6 +195,7 @@ typedef struct {
 } lean_thunk_object;
 
 struct lean_task;
+struct lean_task_waiter;
 
 /* Data required for executing a Lean task. It is released as soon as
    the task terminates even if the task object itself is still referenced. */
@@ -202,6 +203,8 @@ typedef struct {
     lean_object *        m_closure;
     struct lean_task *   m_head_dep;
     struct lean_task *   m_next_dep;
+    /* Threads blocked in `IO.wait`/`IO.waitAny` on this task */
+    struct lean_task_waiter * m_head_waiter;
     unsigned             m_prio;
     uint8_t              m_canceled;
     // If true, task will not be freed until finished
@@ -222,28 +225,28 @@ typedef struct {
 
    states:
    * Queued
-     * condition: in task_manager::m_queues && m_imp != nullptr && !m_imp->m_deleted
+     * condition: in a task_manager worker or shared queue && m_imp != nullptr && !m_imp->m_deleted
      * invariant: m_value == nullptr
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: dequeued by worker thread            ==> Running     (`spawn_worker` lock)
+     * transition: dequeued by worker thread            ==> Running     (`run_task` lock)
    * Waiting
      * condition: reachable from task via `m_head_dep->m_next_dep->...` && !m_imp->m_deleted
      * invariant: m_imp != nullptr && m_value == nullptr
      * invariant: task dependency is Queued/Waiting/Running
        * It cannot become Deactivated because this task should be holding an owned reference to it
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: task dependency Finished ==> Queued (`handle_finished` under `spawn_worker` lock)
+     * transition: task dependency Finished ==> Queued (`handle_finished` under `run_task` lock)
    * Promised
      * condition: obtained as result from promise
      * invariant: m_imp != nullptr && m_value == nullptr
-     * transition: promise resolved ==> Finished (`resolve_core` under `spawn_worker` lock)
+     * transition: promise resolved ==> Finished (`resolve_core` under `run_task`/`resolve` lock)
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
    * Running
      * condition: m_imp != nullptr && m_imp->m_closure == nullptr
        * The worker takes ownership of the closure when running it
      * invariant: m_value == nullptr
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: finished execution                   ==> Finished    (`spawn_worker` lock)
+     * transition: finished execution                   ==> Finished    (`run_task` lock)
    * Deactivated
      * condition: m_imp != nullptr && m_imp->m_deleted
      * invariant: RC == 0
@@ -882,6 +885,7 @@ static inline uint8_t lean_byte_array_fget(b_lean_obj_arg a, b_lean_obj_arg i) {
 }
 
 LEAN_EXPORT lean_obj_res lean_byte_array_push(lean_obj_arg a, uint8_t b);
+LEAN_EXPORT lean_obj_res lean_byte_array_index_of(b_lean_obj_arg a, uint8_t b, b_lean_obj_arg start);
 
 static inline lean_object * lean_byte_array_uset(lean_obj_arg a, size_t i, uint8_t v) {
     lean_obj_res r;
@@ -1037,6 +1041,8 @@ static inline uint8_t lean_string_utf8_at_end(b_lean_obj_arg s, b_lean_obj_arg i
     return !lean_is_scalar(i) || lean_unbox(i) >= lean_string_size(s) - 1;
 }
 LEAN_EXPORT lean_obj_res lean_string_utf8_extract(b_lean_obj_arg s, b_lean_obj_arg b, b_lean_obj_arg e);
+LEAN_EXPORT lean_obj_res lean_string_find(b_lean_obj_arg s, b_lean_obj_arg pattern, b_lean_obj_arg start);
+LEAN_EXPORT lean_obj_res lean_string_count_char(b_lean_obj_arg s, uint32_t c);
 static inline lean_obj_res lean_string_utf8_byte_size(b_lean_obj_arg s) { return lean_box(lean_string_size(s) - 1); }
 LEAN_EXPORT bool lean_string_eq_cold(b_lean_obj_arg s1, b_lean_obj_arg s2);
 static inline bool lean_string_eq(b_lean_obj_arg s1, b_lean_obj_arg s2) {
@@ -1100,6 +1106,9 @@ static inline lean_obj_res lean_task_bind(lean_obj_arg x, lean_obj_arg f, lean_o
 LEAN_EXPORT lean_obj_res lean_task_map_core(lean_obj_arg f, lean_obj_arg t, unsigned prio, bool sync, bool keep_alive);
 /* Task.map (f : A -> B) (t : Task A) (prio : Nat) (sync : Bool) : Task B */
 static inline lean_obj_res lean_task_map(lean_obj_arg f, lean_obj_arg t, lean_obj_arg prio, uint8_t sync) { return lean_task_map_core(f, t, lean_unbox(prio), sync, false); }
+LEAN_EXPORT lean_obj_res lean_task_map_list_core(lean_obj_arg f, lean_obj_arg tasks, unsigned prio, bool sync, bool keep_alive);
+/* Task.mapList (f : List A -> B) (tasks : List (Task A)) (prio : Nat) (sync : Bool) : Task B */
+static inline lean_obj_res lean_task_map_list(lean_obj_arg f, lean_obj_arg tasks, lean_obj_arg prio, uint8_t sync) { return lean_task_map_list_core(f, tasks, lean_unbox(prio), sync, false); }
 LEAN_EXPORT b_lean_obj_res lean_task_get(b_lean_obj_arg t);
 /* Primitive for implementing Task.get : Task A -> A */
 static inline lean_obj_res lean_task_get_own(lean_obj_arg t) {
@@ -1958,6 +1967,7 @@ LEAN_EXPORT lean_obj_res lean_st_ref_get(b_lean_obj_arg, lean_obj_arg);
 LEAN_EXPORT lean_obj_res lean_st_ref_set(b_lean_obj_arg, lean_obj_arg, lean_obj_arg);
 LEAN_EXPORT lean_obj_res lean_st_ref_reset(b_lean_obj_arg, lean_obj_arg);
 LEAN_EXPORT lean_obj_res lean_st_ref_swap(b_lean_obj_arg, lean_obj_arg, lean_obj_arg);
+LEAN_EXPORT lean_obj_res lean_st_ref_cas(b_lean_obj_arg, b_lean_obj_arg, lean_obj_arg, lean_obj_arg);
 
 /* pointer address unsafe primitive  */
 static inline size_t lean_ptr_addr(b_lean_obj_arg a) { return (size_t)a; }
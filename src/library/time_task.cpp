@@ -8,6 +8,7 @@ Author: Sebastian Ullrich
 #include <map>
 #include "library/time_task.h"
 #include "kernel/trace.h"
+#include "runtime/trace_event.h"
 
 namespace lean {
 
@@ -56,9 +57,15 @@ time_task::time_task(std::string const & category, options const & opts, name de
         m_parent_task = g_current_time_task;
         g_current_time_task = this;
     }
+    if (trace_events_enabled()) {
+        m_traced = true;
+        trace_event_begin(m_category, "profile", decl ? trace_event_arg("decl", decl.to_string()) : "");
+    }
 }
 
 time_task::~time_task() {
+    if (m_traced)
+        trace_event_end();
     if (m_timeit) {
         g_current_time_task = m_parent_task;
         report_profiling_time(m_category, m_timeit->get_elapsed());
@@ -19,6 +19,7 @@ class time_task {
     std::string     m_category;
     optional<xtimeit> m_timeit;
     time_task *     m_parent_task;
+    bool            m_traced{false};
 public:
     time_task(std::string const & category, options const & opts, name decl = name());
     ~time_task();
@@ -5,10 +5,21 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 #include <lean/lean.h>
 #include "runtime/thread.h"
 #include "runtime/debug.h"
 #include "runtime/alloc.h"
+#include "runtime/heap_profile.h"
+
+#if defined(LEAN_WINDOWS)
+#include <windows.h>
+#elif !defined(LEAN_EMSCRIPTEN)
+#include <sys/mman.h>
+#endif
 
 #ifdef LEAN_RUNTIME_STATS
 #define LEAN_RUNTIME_STAT_CODE(c) c
@@ -25,10 +36,20 @@ Author: Leonardo de Moura
 #define LEAN_PAGE_SIZE             8192        // 8 Kb
 #define LEAN_SEGMENT_SIZE          8*1024*1024 // 8 Mb
 #define LEAN_NUM_SLOTS             (LEAN_MAX_SMALL_OBJECT_SIZE / LEAN_OBJECT_SIZE_DELTA)
-#define LEAN_MAX_TO_EXPORT_OBJS    1024
+#define LEAN_DEFAULT_DECOMMIT_DELAY 1000       // ms
+#define LEAN_HUGE_PAGE_SIZE        2*1024*1024 // 2 Mb
+#define LEAN_MAX_MEDIUM_OBJECT_SIZE 1024*1024  // 1 Mb
+#define LEAN_MEDIUM_CLASSES_PER_DOUBLING 4
+/* Medium size classes cover (LEAN_MAX_SMALL_OBJECT_SIZE, LEAN_MAX_MEDIUM_OBJECT_SIZE], i.e., 8 doublings */
+#define LEAN_NUM_MEDIUM_CLASSES    (8*LEAN_MEDIUM_CLASSES_PER_DOUBLING)
+#define LEAN_MEDIUM_CACHE_SIZE     8*1024*1024 // 8 Mb
 
 LEAN_CASSERT(LEAN_PAGE_SIZE > LEAN_MAX_SMALL_OBJECT_SIZE);
 LEAN_CASSERT(LEAN_SEGMENT_SIZE > LEAN_PAGE_SIZE);
+LEAN_CASSERT((LEAN_SEGMENT_SIZE) % (LEAN_HUGE_PAGE_SIZE) == 0);
+/* `get_medium_class_idx` assumes that medium objects start at 2^12 bytes */
+LEAN_CASSERT(LEAN_MAX_SMALL_OBJECT_SIZE == 1 << 12);
+LEAN_CASSERT(LEAN_MAX_SMALL_OBJECT_SIZE << 8 == LEAN_MAX_MEDIUM_OBJECT_SIZE);
 
 namespace lean {
 
@@ -42,8 +63,14 @@ static atomic<uint64> g_num_dealloc(0);
 static atomic<uint64> g_num_small_dealloc(0);
 static atomic<uint64> g_num_segments(0);
 static atomic<uint64> g_num_pages(0);
-static atomic<uint64> g_num_exports(0);
+static atomic<uint64> g_num_remote_frees(0);
+static atomic<uint64> g_num_remote_pages(0);
+static atomic<uint64> g_num_remote_collects(0);
 static atomic<uint64> g_num_recycled_pages(0);
+static atomic<uint64> g_num_reused_pages(0);
+static atomic<uint64> g_num_medium_alloc(0);
+static atomic<uint64> g_num_medium_cached_alloc(0);
+static atomic<uint64> g_num_medium_resize_in_place(0);
 struct alloc_stats {
     ~alloc_stats() {
         std::cerr << "num. alloc.:         " << g_num_alloc << "\n";
@@ -53,12 +80,36 @@ struct alloc_stats {
         std::cerr << "num. segments:       " << g_num_segments << "\n";
         std::cerr << "num. pages:          " << g_num_pages << "\n";
         std::cerr << "num. recycled pages: " << g_num_recycled_pages << "\n";
-        std::cerr << "num. exports:        " << g_num_exports << "\n";
+        std::cerr << "num. reused empty pages: " << g_num_reused_pages << "\n";
+        std::cerr << "num. remote frees:   " << g_num_remote_frees << "\n";
+        std::cerr << "num. remote pages:   " << g_num_remote_pages << "\n";
+        std::cerr << "num. remote collects:" << g_num_remote_collects << "\n";
+        std::cerr << "num. medium alloc.:  " << g_num_medium_alloc << "\n";
+        std::cerr << "num. cached medium alloc.: " << g_num_medium_cached_alloc << "\n";
+        std::cerr << "num. in-place medium resizes: " << g_num_medium_resize_in_place << "\n";
     }
 };
 static alloc_stats g_alloc_stats;
 #endif
 
+/* Memory of pages handed out by the segments of all heaps, excluding decommitted pages */
+static std::atomic<size_t> g_committed_page_bytes(0);
+static std::atomic<uint64_t> g_num_decommitted_pages(0);
+static std::atomic<uint64_t> g_num_recommitted_pages(0);
+/* Whether empty pages are returned to the OS at all. Disabled unless `LEAN_DECOMMIT_DELAY` or `LEAN_RSS_TARGET` is
+   set, as the freed memory is usually reused soon. */
+static bool g_decommit = false;
+/* Pages that have been empty for at least this long are returned to the OS... */
+static uint64_t g_decommit_delay_ms = LEAN_DEFAULT_DECOMMIT_DELAY;
+/* ...as long as more than this many bytes of pages are committed. */
+static size_t g_rss_target = 0;
+/* Whether to back segments by transparent huge pages, see `LEAN_HUGE_PAGES` */
+static bool g_huge_pages = false;
+
+static uint64_t now_ms() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 struct heap;
 struct page;
 struct page_header {
@@ -66,11 +117,20 @@ struct page_header {
     page *           m_next;
     page *           m_prev;
     void *           m_free_list;
+    /* Objects of this page freed by threads other than the owner of `m_heap`. It is pushed to lock-free by
+       other threads and only emptied by the owner, see `heap::collect_remote_frees`. */
+    std::atomic<void *> m_remote_free_list;
+    /* Next page in `heap::m_remote_pages` */
+    page *           m_next_remote;
     unsigned         m_obj_size;
     unsigned         m_max_free;
     unsigned         m_num_free;
     unsigned         m_slot_idx;
     bool             m_in_page_free_list;
+    /* Whether the page is in `heap::m_empty_pages` */
+    bool             m_empty;
+    /* Time at which the page was added to `heap::m_empty_pages` */
+    uint64_t         m_empty_since;
 };
 
 struct page {
@@ -83,6 +143,7 @@ struct page {
     void set_heap(heap * h) { m_header.m_heap = h; }
     heap * get_heap() { return m_header.m_heap; }
     bool has_many_free() const { return m_header.m_num_free > m_header.m_max_free / 4; }
+    bool is_empty() const { return m_header.m_num_free == m_header.m_max_free; }
     bool in_page_free_list() const { return m_header.m_in_page_free_list; }
     unsigned get_slot_idx() const { return m_header.m_slot_idx; }
     void push_free_obj(void * o);
@@ -92,23 +153,21 @@ inline char * align_ptr(char * p, size_t a) {
     return reinterpret_cast<char*>(lean_align(reinterpret_cast<size_t>(p), a));
 }
 
+/* Header at the beginning of a block of `sz` bytes whose remaining (page aligned) memory is handed out as pages */
 struct segment {
     segment *    m_next{nullptr};
     char *       m_next_page_mem;
-    char         m_data[LEAN_SEGMENT_SIZE];
+    char *       m_end;
 
-    char * get_first_page_mem() {
-        lean_assert(align_ptr(m_data, LEAN_PAGE_SIZE) >= m_data);
-        lean_assert(align_ptr(m_data, LEAN_PAGE_SIZE) > reinterpret_cast<char*>(this));
-        return align_ptr(m_data, LEAN_PAGE_SIZE);
-    }
-
-    segment() {
-        m_next_page_mem = get_first_page_mem();
+    explicit segment(size_t sz) {
+        char * mem      = reinterpret_cast<char*>(this);
+        m_next_page_mem = align_ptr(mem + sizeof(segment), LEAN_PAGE_SIZE);
+        m_end           = mem + sz;
+        lean_assert(!is_full());
     }
 
     bool is_full() const {
-        return m_next_page_mem + LEAN_PAGE_SIZE > m_data + LEAN_SEGMENT_SIZE;
+        return m_next_page_mem + LEAN_PAGE_SIZE > m_end;
     }
 };
 
@@ -117,17 +176,25 @@ struct heap {
     heap *    m_next_orphan{nullptr};
     page *    m_curr_page[LEAN_NUM_SLOTS];
     page *    m_page_free_list[LEAN_NUM_SLOTS];
-    /* Objects that must be sent to other heaps. */
-    void *    m_to_export_list{nullptr};
-    unsigned  m_to_export_list_size{0};
-    mutex     m_mutex; /* for the following fields */
-    /* The following list contains object by this heap that were deallocated
-       by other heaps. */
-    void *    m_to_import_list{nullptr};
+    /* Pages of this heap with a non-empty `m_remote_free_list`. A page is pushed by the thread that makes its
+       remote free list non-empty, so it occurs at most once in this list. */
+    std::atomic<page *> m_remote_pages{nullptr};
+    /* Pages without any live objects, which can be reused for any object size. Most recently emptied first. */
+    page *    m_empty_pages{nullptr};
+    page *    m_empty_pages_tail{nullptr};
+    /* Empty pages whose memory has been returned to the OS */
+    std::vector<page *> m_decommitted_pages;
+    /* Freed medium objects by size class, linked through their first word, see `alloc_medium` */
+    void *    m_medium_free_list[LEAN_NUM_MEDIUM_CLASSES];
+    size_t    m_medium_cached_bytes{0};
     uint64_t  m_heartbeat{0}; /* Counter for implementing "deterministic timeouts". It is currently the number of small allocations */
-    void import_objs();
-    void export_objs();
+    int64_t   m_bytes_until_sample{0}; /* See `heap_profile_next_sample_interval` */
+    void collect_remote_frees();
     void alloc_segment();
+    void push_empty_page(page * p);
+    page * pop_empty_page();
+    bool decommit_empty_pages(uint64_t now, uint64_t delay);
+    void flush_medium_free_lists();
 };
 
 struct heap_manager {
@@ -175,32 +242,88 @@ static inline void page_list_insert(page * & head, page * new_head) {
     if (head)
         head->set_prev(new_head);
     new_head->set_next(head);
+    new_head->set_prev(nullptr);
     head = new_head;
 }
 
 static inline void page_list_remove(page * & head, page * to_remove) {
+    page * prev = to_remove->get_prev();
+    page * next = to_remove->get_next();
     if (head == to_remove) {
         /* First element */
-        head = to_remove->get_next();
-    }
-    page * prev = to_remove->get_prev();
-    lean_assert(prev);
-    if (page * next = to_remove->get_next()) {
-        prev->set_next(next);
-        next->set_prev(prev);
+        head = next;
     } else {
-        /* Last element */
-        prev->set_next(nullptr);
+        lean_assert(prev);
+        prev->set_next(next);
     }
+    if (next)
+        next->set_prev(head == next ? nullptr : prev);
 }
 
 static inline page * page_list_pop(page * & head) {
     lean_assert(head);
     page * r = head;
     head = head->get_next();
+    if (head)
+        head->set_prev(nullptr);
     return r;
 }
 
+void heap::push_empty_page(page * p) {
+    p->m_header.m_empty = true;
+    p->m_header.m_empty_since = now_ms();
+    if (!m_empty_pages_tail)
+        m_empty_pages_tail = p;
+    page_list_insert(m_empty_pages, p);
+}
+
+page * heap::pop_empty_page() {
+    if (m_empty_pages) {
+        if (m_empty_pages == m_empty_pages_tail)
+            m_empty_pages_tail = nullptr;
+        page * p = page_list_pop(m_empty_pages);
+        p->m_header.m_empty = false;
+        return p;
+    }
+    if (!m_decommitted_pages.empty()) {
+        page * p = m_decommitted_pages.back();
+        m_decommitted_pages.pop_back();
+        g_num_recommitted_pages++;
+        g_committed_page_bytes += LEAN_PAGE_SIZE;
+        return p;
+    }
+    return nullptr;
+}
+
+static void decommit(page * p) {
+#if defined(LEAN_WINDOWS)
+    VirtualAlloc(p, LEAN_PAGE_SIZE, MEM_RESET, PAGE_READWRITE);
+#elif !defined(LEAN_EMSCRIPTEN)
+    madvise(p, LEAN_PAGE_SIZE, MADV_DONTNEED);
+#endif
+}
+
+/* Return pages that have been empty since at least `now - delay` to the OS, oldest first, unless the
+   committed memory is within the configured target. Returns `true` if more pages may be returned later.
+   This is only done by idle or exiting threads, never on the deallocation path. */
+bool heap::decommit_empty_pages(uint64_t now, uint64_t delay) {
+    if (!g_decommit)
+        return false;
+    while (page * p = m_empty_pages_tail) {
+        if (g_committed_page_bytes <= g_rss_target)
+            return false;
+        if (p->m_header.m_empty_since + delay > now)
+            return true;
+        m_empty_pages_tail = p->get_prev();
+        page_list_remove(m_empty_pages, p);
+        decommit(p);
+        m_decommitted_pages.push_back(p);
+        g_num_decommitted_pages++;
+        g_committed_page_bytes -= LEAN_PAGE_SIZE;
+    }
+    return false;
+}
+
 void page::push_free_obj(void * o) {
     lean_assert(get_page_of(o) == this);
     set_next_obj(o, m_header.m_free_list);
@@ -216,75 +339,100 @@ void page::push_free_obj(void * o) {
             page_list_insert(h->m_page_free_list[slot_idx], this);
         }
     }
+    if (in_page_free_list() && is_empty()) {
+        /* Make the page available to all object sizes, and eventually return it to the OS, see `release_empty_pages` */
+        heap * h = get_heap();
+        m_header.m_in_page_free_list = false;
+        page_list_remove(h->m_page_free_list[m_header.m_slot_idx], this);
+        h->push_empty_page(this);
+    }
 }
 
-void heap::import_objs() {
-    void * to_import = nullptr;
-    {   // TODO(Leo): avoid mutex using compare and swap
-        lock_guard<mutex> lock(m_mutex);
-        to_import = m_to_import_list;
-        m_to_import_list = nullptr;
-    }
-    while (to_import) {
-        page * p = get_page_of(to_import);
-        void * n = get_next_obj(to_import);
-        p->push_free_obj(to_import);
-        to_import = n;
+/* Move objects freed by other threads back into the free lists of their pages. Must be called by the owner. */
+void heap::collect_remote_frees() {
+    page * p = m_remote_pages.exchange(nullptr, std::memory_order_acquire);
+    LEAN_RUNTIME_STAT_CODE(if (p) g_num_remote_collects++);
+    while (p) {
+        /* `p` may be pushed to `m_remote_pages` again as soon as its remote free list is emptied below,
+           so we must read the link first. */
+        page * next = p->m_header.m_next_remote;
+        void * o = p->m_header.m_remote_free_list.exchange(nullptr, std::memory_order_acquire);
+        while (o) {
+            void * n = get_next_obj(o);
+            p->push_free_obj(o);
+            o = n;
+        }
+        p = next;
     }
 }
 
-struct export_entry {
-    heap * m_heap;
-    void * m_head;
-    void * m_tail;
-};
+/* Push `o` to the remote free list of its page `p`, which is owned by a different thread. */
+static void push_remote_free_obj(page * p, void * o) {
+    LEAN_RUNTIME_STAT_CODE(g_num_remote_frees++);
+    void * head = p->m_header.m_remote_free_list.load(std::memory_order_relaxed);
+    do {
+        set_next_obj(o, head);
+    } while (!p->m_header.m_remote_free_list.compare_exchange_weak(head, o, std::memory_order_release,
+                                                                      std::memory_order_relaxed));
+    if (head == nullptr) {
+        /* We made the list non-empty, so we are responsible for notifying the owner */
+        LEAN_RUNTIME_STAT_CODE(g_num_remote_pages++);
+        heap * h = p->get_heap();
+        page * pages = h->m_remote_pages.load(std::memory_order_relaxed);
+        do {
+            p->m_header.m_next_remote = pages;
+        } while (!h->m_remote_pages.compare_exchange_weak(pages, p, std::memory_order_release,
+                                                          std::memory_order_relaxed));
+    }
+}
 
-void heap::export_objs() {
-    std::vector<export_entry> to_export;
-    void * o = m_to_export_list;
-    while (o != nullptr) {
-        void * n   = get_next_obj(o);
-        heap * h   = get_page_of(o)->get_heap();
-        bool found = false;
-        for (export_entry & e : to_export) {
-            if (e.m_heap == h) {
-                set_next_obj(o, e.m_head);
-                e.m_head = o;
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
-            set_next_obj(o, nullptr);
-            to_export.push_back(export_entry{h, o, o});
+/* Allocate the memory of a new segment and store its size in `sz`. */
+static void * alloc_segment_memory(size_t & sz) {
+#if defined(MADV_HUGEPAGE)
+    if (g_huge_pages) {
+        /* Align the segment to huge pages and ask the kernel to back it by transparent huge pages. The segment
+           header is stored in its first page so that the segment consists of exactly
+           `LEAN_SEGMENT_SIZE / LEAN_HUGE_PAGE_SIZE` huge pages. Note that decommitting a single page of a segment
+           will split the surrounding huge page again. */
+        sz = LEAN_SEGMENT_SIZE;
+        void * mem = nullptr;
+        if (posix_memalign(&mem, LEAN_HUGE_PAGE_SIZE, sz) == 0) {
+            madvise(mem, sz, MADV_HUGEPAGE);
+            return mem;
         }
-        o = n;
-    }
-    m_to_export_list      = nullptr;
-    m_to_export_list_size = 0;
-    for (export_entry const & e : to_export) {
-        unique_lock<mutex> lock(e.m_heap->m_mutex);
-        set_next_obj(e.m_tail, e.m_heap->m_to_import_list);
-        e.m_heap->m_to_import_list = e.m_head;
     }
+#endif
+    sz = sizeof(segment) + LEAN_SEGMENT_SIZE;
+    void * mem = malloc(sz);
+    if (mem == nullptr) lean_internal_panic_out_of_memory();
+    return mem;
 }
 
 void heap::alloc_segment() {
     LEAN_RUNTIME_STAT_CODE(g_num_segments++);
-    segment * s = new segment();
+    size_t sz;
+    void * mem  = alloc_segment_memory(sz);
+    segment * s = new (mem) segment(sz);
     s->m_next   = m_curr_segment;
     m_curr_segment = s;
 }
 
 static page * alloc_page(heap * h, unsigned obj_size) {
     lean_assert(lean_align(obj_size, LEAN_OBJECT_SIZE_DELTA) == obj_size);
-    segment * s = h->m_curr_segment;
-    LEAN_RUNTIME_STAT_CODE(g_num_pages++);
-    page * p    = new (s->m_next_page_mem) page();
-    s->m_next_page_mem += LEAN_PAGE_SIZE;
-    if (s->is_full()) {
-        /* s is full, we need to allocate a new one. */
-        h->alloc_segment();
+    page * p;
+    if (page * e = h->pop_empty_page()) {
+        LEAN_RUNTIME_STAT_CODE(g_num_reused_pages++);
+        p = new (e) page();
+    } else {
+        segment * s = h->m_curr_segment;
+        LEAN_RUNTIME_STAT_CODE(g_num_pages++);
+        p = new (s->m_next_page_mem) page();
+        s->m_next_page_mem += LEAN_PAGE_SIZE;
+        g_committed_page_bytes += LEAN_PAGE_SIZE;
+        if (s->is_full()) {
+            /* s is full, we need to allocate a new one. */
+            h->alloc_segment();
+        }
     }
     unsigned slot_idx        = lean_get_slot_idx(obj_size);
     p->m_header.m_heap       = h;
@@ -315,16 +463,21 @@ static page * alloc_page(heap * h, unsigned obj_size) {
             lean_assert(n == num_free);
 #endif
     p->m_header.m_free_list  = curr_free;
+    p->m_header.m_remote_free_list = nullptr;
+    p->m_header.m_next_remote = nullptr;
     p->m_header.m_max_free   = num_free;
     p->m_header.m_num_free   = num_free;
     p->m_header.m_in_page_free_list = false;
+    p->m_header.m_empty = false;
     return p;
 }
 
 static void finalize_heap(void * _h) {
     heap * h = static_cast<heap*>(_h);
-    h->export_objs();
-    h->import_objs();
+    h->collect_remote_frees();
+    h->flush_medium_free_lists();
+    /* nobody is going to allocate from this heap for a while */
+    h->decommit_empty_pages(now_ms(), 0);
     g_heap_manager->push_orphan(h);
 }
 
@@ -336,11 +489,14 @@ static void init_heap(bool main) {
         g_heap = h;
     } else {
         g_heap = new heap();
+        g_heap->m_bytes_until_sample = heap_profile_next_sample_interval();
         g_curr_pages = g_heap->m_curr_page;
         for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
             g_heap->m_curr_page[i] = nullptr;
             g_heap->m_page_free_list[i] = nullptr;
         }
+        for (unsigned i = 0; i < LEAN_NUM_MEDIUM_CLASSES; i++)
+            g_heap->m_medium_free_list[i] = nullptr;
         g_heap->alloc_segment();
         unsigned obj_size = LEAN_OBJECT_SIZE_DELTA;
         for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
@@ -362,10 +518,13 @@ void init_thread_heap() {
 
 LEAN_NOINLINE
 void * lean_alloc_small_cold(unsigned sz, unsigned slot_idx, page * p) {
-    if (g_heap->m_page_free_list[slot_idx] == nullptr) {
-        g_heap->import_objs();
+    if (g_heap->m_page_free_list[slot_idx] == nullptr &&
+        g_heap->m_remote_pages.load(std::memory_order_relaxed) != nullptr) {
+        g_heap->collect_remote_frees();
         lean_assert(g_heap->m_curr_page[slot_idx] == p);
-        /* g_heap->import_objs() may add objects to p->m_header.m_free_list */
+    }
+    if (g_heap->m_page_free_list[slot_idx] == nullptr) {
+        /* g_heap->collect_remote_frees() may add objects to p->m_header.m_free_list */
         if (p->m_header.m_free_list == nullptr)
             p = alloc_page(g_heap, sz);
     } else {
@@ -381,7 +540,7 @@ void * lean_alloc_small_cold(unsigned sz, unsigned slot_idx, page * p) {
     return r;
 }
 
-extern "C" LEAN_EXPORT void * lean_alloc_small(unsigned sz, unsigned slot_idx) {
+static inline void * alloc_small_core(unsigned sz, unsigned slot_idx) {
     page * p = g_heap->m_curr_page[slot_idx];
     g_heap->m_heartbeat++;
     void * r = p->m_header.m_free_list;
@@ -394,12 +553,99 @@ extern "C" LEAN_EXPORT void * lean_alloc_small(unsigned sz, unsigned slot_idx) {
     return r;
 }
 
+/* Remark: we must not re-enter `lean_alloc_small` here, as the new sampling interval may be smaller than `sz`. */
+LEAN_NOINLINE
+static void * lean_alloc_small_sampled(unsigned sz, unsigned slot_idx) {
+    g_heap->m_bytes_until_sample = heap_profile_next_sample_interval();
+    void * r = alloc_small_core(sz, slot_idx);
+    heap_profile_record_alloc(r, sz);
+    return r;
+}
+
+extern "C" LEAN_EXPORT void * lean_alloc_small(unsigned sz, unsigned slot_idx) {
+    if (LEAN_UNLIKELY((g_heap->m_bytes_until_sample -= sz) < 0))
+        return lean_alloc_small_sampled(sz, slot_idx);
+    return alloc_small_core(sz, slot_idx);
+}
+
+/* Medium objects, i.e., objects of size in (LEAN_MAX_SMALL_OBJECT_SIZE, LEAN_MAX_MEDIUM_OBJECT_SIZE], are
+   allocated using `malloc` after rounding their size up to one of `LEAN_MEDIUM_CLASSES_PER_DOUBLING` size classes
+   per power of two. Freed medium objects are kept in thread-local free lists by size class (up to
+   `LEAN_MEDIUM_CACHE_SIZE` bytes per thread), so that the arrays and strings that are repeatedly grown and
+   released by most programs do not go through `malloc`'s locks, and growing an object within its size class
+   does not need to copy it at all (see `realloc_sized`). As a `malloc` block does not belong to any heap, a
+   medium object freed by a different thread is simply added to the free lists of that thread. */
+static inline unsigned get_medium_class_idx(size_t sz) {
+    lean_assert(sz > LEAN_MAX_SMALL_OBJECT_SIZE && sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE);
+    size_t s    = sz - 1;
+    unsigned e  = 63 - __builtin_clzll(s);
+    size_t step = (static_cast<size_t>(1) << e) / LEAN_MEDIUM_CLASSES_PER_DOUBLING;
+    unsigned i  = (s - (static_cast<size_t>(1) << e)) / step;
+    return (e - 12) * LEAN_MEDIUM_CLASSES_PER_DOUBLING + i;
+}
+
+static inline size_t get_medium_class_size(unsigned class_idx) {
+    unsigned e  = 12 + class_idx / LEAN_MEDIUM_CLASSES_PER_DOUBLING;
+    size_t step = (static_cast<size_t>(1) << e) / LEAN_MEDIUM_CLASSES_PER_DOUBLING;
+    return (static_cast<size_t>(1) << e) + (class_idx % LEAN_MEDIUM_CLASSES_PER_DOUBLING + 1) * step;
+}
+
+static void * alloc_medium(size_t sz) {
+    LEAN_RUNTIME_STAT_CODE(g_num_medium_alloc++);
+    unsigned class_idx = get_medium_class_idx(sz);
+    void * r = g_heap ? g_heap->m_medium_free_list[class_idx] : nullptr;
+    if (r) {
+        LEAN_RUNTIME_STAT_CODE(g_num_medium_cached_alloc++);
+        g_heap->m_medium_free_list[class_idx] = get_next_obj(r);
+        g_heap->m_medium_cached_bytes -= get_medium_class_size(class_idx);
+        return r;
+    }
+    r = malloc(get_medium_class_size(class_idx));
+    if (r == nullptr) lean_internal_panic_out_of_memory();
+    return r;
+}
+
+static void dealloc_medium(void * o, size_t sz) {
+    if (LEAN_UNLIKELY(g_heap == nullptr)) {
+        init_heap(false);
+    }
+    unsigned class_idx = get_medium_class_idx(sz);
+    size_t class_sz    = get_medium_class_size(class_idx);
+    if (g_heap->m_medium_cached_bytes + class_sz > LEAN_MEDIUM_CACHE_SIZE)
+        return free(o);
+    set_next_obj(o, g_heap->m_medium_free_list[class_idx]);
+    g_heap->m_medium_free_list[class_idx] = o;
+    g_heap->m_medium_cached_bytes += class_sz;
+}
+
+void heap::flush_medium_free_lists() {
+    for (unsigned i = 0; i < LEAN_NUM_MEDIUM_CLASSES; i++) {
+        void * o = m_medium_free_list[i];
+        while (o) {
+            void * n = get_next_obj(o);
+            free(o);
+            o = n;
+        }
+        m_medium_free_list[i] = nullptr;
+    }
+    m_medium_cached_bytes = 0;
+}
+
 void * alloc(size_t sz) {
     sz = lean_align(sz, LEAN_OBJECT_SIZE_DELTA);
     LEAN_RUNTIME_STAT_CODE(g_num_alloc++);
     if (LEAN_UNLIKELY(sz > LEAN_MAX_SMALL_OBJECT_SIZE)) {
-        void * r = malloc(sz);
-        if (r == nullptr) lean_internal_panic_out_of_memory();
+        void * r;
+        if (sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE) {
+            r = alloc_medium(sz);
+        } else {
+            r = malloc(sz);
+            if (r == nullptr) lean_internal_panic_out_of_memory();
+        }
+        if (g_heap && LEAN_UNLIKELY((g_heap->m_bytes_until_sample -= sz) < 0)) {
+            g_heap->m_bytes_until_sample = heap_profile_next_sample_interval();
+            heap_profile_record_alloc(r, sz);
+        }
         return r;
     }
     lean_assert(g_heap);
@@ -408,19 +654,9 @@ void * alloc(size_t sz) {
     return lean_alloc_small(sz, slot_idx);
 }
 
-LEAN_NOINLINE
-static void dealloc_small_core_cold(void * o) {
-    set_next_obj(o, g_heap->m_to_export_list);
-    g_heap->m_to_export_list = o;
-    g_heap->m_to_export_list_size++;
-    if (g_heap->m_to_export_list_size > LEAN_MAX_TO_EXPORT_OBJS) {
-        LEAN_RUNTIME_STAT_CODE(g_num_exports++);
-        g_heap->export_objs();
-    }
-}
-
 static inline void dealloc_small_core(void * o) {
     LEAN_RUNTIME_STAT_CODE(g_num_small_dealloc++);
+    heap_profile_record_free(o);
     if (LEAN_UNLIKELY(g_heap == nullptr)) {
         init_heap(false);
     }
@@ -429,7 +665,7 @@ static inline void dealloc_small_core(void * o) {
     if (LEAN_LIKELY(p->get_heap() == g_heap)) {
         p->push_free_obj(o);
     } else {
-        dealloc_small_core_cold(o);
+        push_remote_free_obj(p, o);
     }
 }
 
@@ -437,11 +673,46 @@ void dealloc(void * o, size_t sz) {
     LEAN_RUNTIME_STAT_CODE(g_num_dealloc++);
     sz = lean_align(sz, LEAN_OBJECT_SIZE_DELTA);
     if (LEAN_UNLIKELY(sz > LEAN_MAX_SMALL_OBJECT_SIZE)) {
+        heap_profile_record_free(o);
+        if (sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE)
+            return dealloc_medium(o, sz);
         return free(o);
     }
     dealloc_small_core(o);
 }
 
+size_t alloc_size(size_t sz) {
+    sz = lean_align(sz, LEAN_OBJECT_SIZE_DELTA);
+    if (sz > LEAN_MAX_SMALL_OBJECT_SIZE && sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE)
+        return get_medium_class_size(get_medium_class_idx(sz));
+    return sz;
+}
+
+void * realloc_sized(void * o, size_t old_sz, size_t new_sz) {
+    size_t old_asz = alloc_size(old_sz);
+    if (old_asz == alloc_size(new_sz)) {
+        LEAN_RUNTIME_STAT_CODE(if (old_asz > LEAN_MAX_SMALL_OBJECT_SIZE) g_num_medium_resize_in_place++);
+        return o;
+    }
+    if (old_asz > LEAN_MAX_MEDIUM_OBJECT_SIZE && new_sz > LEAN_MAX_MEDIUM_OBJECT_SIZE) {
+        /* Let `malloc` grow large objects without copying if possible (e.g., using `mremap`) */
+        bool sampled = heap_profile_record_free(o);
+        void * r = ::realloc(o, lean_align(new_sz, LEAN_OBJECT_SIZE_DELTA));
+        if (r == nullptr) lean_internal_panic_out_of_memory();
+        /* Like `alloc(new_sz)`, but keep sampled objects in the profile */
+        bool sample = g_heap && LEAN_UNLIKELY((g_heap->m_bytes_until_sample -= new_sz) < 0);
+        if (sample)
+            g_heap->m_bytes_until_sample = heap_profile_next_sample_interval();
+        if (sampled || sample)
+            heap_profile_record_alloc(r, new_sz);
+        return r;
+    }
+    void * r = alloc(new_sz);
+    memcpy(r, o, old_sz < new_sz ? old_sz : new_sz);
+    dealloc(o, old_sz);
+    return r;
+}
+
 extern "C" LEAN_EXPORT void lean_free_small(void * o) {
     dealloc_small_core(o);
 }
@@ -453,8 +724,49 @@ extern "C" LEAN_EXPORT unsigned lean_small_mem_size(void * o) {
 
 #endif
 
+bool release_empty_pages() {
+#ifdef LEAN_SMALL_ALLOCATOR
+    if (g_heap) {
+        /* The thread is idle, so it is unlikely to reuse its cached medium objects soon */
+        g_heap->flush_medium_free_lists();
+        return g_heap->decommit_empty_pages(now_ms(), g_decommit_delay_ms);
+    }
+#endif
+    return false;
+}
+
+uint64_t get_page_decommit_delay() {
+#ifdef LEAN_SMALL_ALLOCATOR
+    return g_decommit_delay_ms;
+#else
+    return 0;
+#endif
+}
+
+void display_alloc_stats(std::ostream & out) {
+#ifdef LEAN_SMALL_ALLOCATOR
+    out << "committed allocator pages:             " << g_committed_page_bytes / 1024 << " KiB\n";
+    out << "decommitted/recommitted pages:         " << g_num_decommitted_pages << "/" << g_num_recommitted_pages << "\n";
+#else
+    (void)out;
+#endif
+}
+
 void initialize_alloc() {
 #ifdef LEAN_SMALL_ALLOCATOR
+#ifndef LEAN_EMSCRIPTEN
+    if (char const * delay = std::getenv("LEAN_DECOMMIT_DELAY")) {
+        g_decommit = true;
+        g_decommit_delay_ms = std::strtoull(delay, nullptr, 10);
+    }
+    if (char const * target = std::getenv("LEAN_RSS_TARGET")) {
+        g_decommit = true;
+        g_rss_target = std::strtoull(target, nullptr, 10) * 1024 * 1024;
+    }
+    if (char const * huge_pages = std::getenv("LEAN_HUGE_PAGES")) {
+        g_huge_pages = *huge_pages && std::string(huge_pages) != "0";
+    }
+#endif
     g_heap_manager = new heap_manager();
     init_heap(true);
 #endif
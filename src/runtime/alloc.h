@@ -7,13 +7,25 @@ Author: Leonardo de Moura
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <iosfwd>
 
 namespace lean {
 void init_thread_heap();
 void * alloc(size_t sz);
 void dealloc(void * o, size_t sz);
+/* Return the number of bytes reserved by `alloc(sz)`. An object can grow up to this size without being moved. */
+size_t alloc_size(size_t sz);
+/* Resize `o`, which was allocated with size `old_sz`, to `new_sz` bytes, preserving its contents.
+   The result is `o` itself if both sizes are in the same size class. */
+void * realloc_sized(void * o, size_t old_sz, size_t new_sz);
 void add_heartbeats(uint64_t count);
 uint64_t get_num_heartbeats();
+/* Return pages of the current thread's heap that have been empty for `LEAN_DECOMMIT_DELAY` ms to the OS, if enabled
+   by setting `LEAN_DECOMMIT_DELAY` or `LEAN_RSS_TARGET`. Should be called when the thread is idle.
+   Returns `true` if more pages may be returned after waiting for the delay. */
+bool release_empty_pages();
+uint64_t get_page_decommit_delay();
+void display_alloc_stats(std::ostream & out);
 void initialize_alloc();
 void finalize_alloc();
 }
@@ -9,7 +9,8 @@ Author: Leonardo de Moura
 #include "runtime/object.h"
 namespace lean {
 /* Low tech runtime allocation profiler.
-   We need to compile Lean using RUNTIME_STATS=ON to use it. */
+   We need to compile Lean using RUNTIME_STATS=ON to use it.
+   See `runtime/heap_profile.h` for a sampling profiler that attributes allocations to functions. */
 class allocprof {
     std::ostream & m_out;
     std::string    m_msg;
@@ -0,0 +1,343 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <utility>
+#include <vector>
+#include <lean/lean.h>
+#include "runtime/channel.h"
+#include "runtime/io.h"
+#include "runtime/object.h"
+#include "runtime/thread.h"
+
+namespace lean {
+/* Lock-free bounded queue by Dmitry Vyukov. Each cell carries a sequence number telling whether it can be written
+   (`seq == pos`) or read (`seq == pos + 1`) at position `pos`, so senders and receivers only contend on their
+   position counters. */
+class bounded_queue {
+    struct cell {
+        std::atomic<size_t> m_seq;
+        object *            m_value;
+    };
+    size_t              m_mask;
+    cell *              m_cells;
+    char                m_pad0[64];
+    std::atomic<size_t> m_send_pos{0};
+    char                m_pad1[64];
+    std::atomic<size_t> m_recv_pos{0};
+    char                m_pad2[64];
+public:
+    explicit bounded_queue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n *= 2;
+        m_mask  = n - 1;
+        m_cells = new cell[n];
+        for (size_t i = 0; i < n; i++)
+            m_cells[i].m_seq.store(i, std::memory_order_relaxed);
+    }
+    ~bounded_queue() { delete[] m_cells; }
+
+    bool try_push(object * v) {
+        size_t pos = m_send_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell & c = m_cells[pos & m_mask];
+            size_t seq = c.m_seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (m_send_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.m_value = v;
+                    c.m_seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false; // full
+            } else {
+                pos = m_send_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(object * & v) {
+        size_t pos = m_recv_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell & c = m_cells[pos & m_mask];
+            size_t seq = c.m_seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) {
+                if (m_recv_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    v = c.m_value;
+                    c.m_seq.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false; // empty
+            } else {
+                pos = m_recv_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+/* Two-lock queue by Michael and Scott. Senders and receivers synchronize on separate locks around a dummy head
+   node, so sending never waits for a receiver and vice versa. */
+class unbounded_queue {
+    struct node {
+        std::atomic<node *> m_next{nullptr};
+        object *            m_value{nullptr};
+    };
+    mutex  m_head_mutex;
+    node * m_head;
+    char   m_pad0[64];
+    mutex  m_tail_mutex;
+    node * m_tail;
+public:
+    unbounded_queue() { m_head = m_tail = new node; }
+    ~unbounded_queue() {
+        while (m_head) {
+            node * next = m_head->m_next.load(std::memory_order_relaxed);
+            delete m_head;
+            m_head = next;
+        }
+    }
+
+    void push(object * v) {
+        node * n = new node;
+        n->m_value = v;
+        lock_guard<mutex> _(m_tail_mutex);
+        m_tail->m_next.store(n, std::memory_order_release);
+        m_tail = n;
+    }
+
+    bool try_pop(object * & v) {
+        node * old_head;
+        {
+            lock_guard<mutex> _(m_head_mutex);
+            node * next = m_head->m_next.load(std::memory_order_acquire);
+            if (next == nullptr)
+                return false;
+            v = next->m_value;
+            next->m_value = nullptr;
+            old_head = m_head;
+            m_head   = next;
+        }
+        delete old_head;
+        return true;
+    }
+};
+
+/* Multi-producer multi-consumer channel, bounded if `m_bounded` is not null.
+
+   Receivers waiting for a message are registered as promises that are resolved by senders. A receiver increments
+   `m_num_waiters` before checking the queue one last time, and a sender checks it after enqueuing, so either the
+   receiver sees the message or the sender sees the receiver. Senders blocked on a full bounded channel are woken up
+   by receivers in the same way. */
+class channel {
+    bounded_queue *        m_bounded{nullptr};
+    unbounded_queue *      m_unbounded{nullptr};
+    std::atomic<bool>      m_closed{false};
+    mutex                  m_waiters_mutex;
+    std::deque<object *>   m_waiters;
+    std::atomic<unsigned>  m_num_waiters{0};
+    mutex                  m_space_mutex;
+    condition_variable     m_space_cv;
+    std::atomic<unsigned>  m_num_blocked_senders{0};
+
+    bool try_push(object * v) {
+        if (m_bounded)
+            return m_bounded->try_push(v);
+        m_unbounded->push(v);
+        return true;
+    }
+
+    bool try_pop(object * & v) {
+        if (!m_bounded)
+            return m_unbounded->try_pop(v);
+        if (!m_bounded->try_pop(v))
+            return false;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_num_blocked_senders.load(std::memory_order_relaxed) > 0) {
+            lock_guard<mutex> _(m_space_mutex);
+            m_space_cv.notify_one();
+        }
+        return true;
+    }
+
+    /* Hand enqueued messages to waiting receivers, if any. */
+    void wake_waiters() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_num_waiters.load(std::memory_order_relaxed) == 0)
+            return;
+        std::vector<std::pair<object *, object *>> ready;
+        {
+            lock_guard<mutex> _(m_waiters_mutex);
+            object * v;
+            while (!m_waiters.empty() && try_pop(v)) {
+                ready.emplace_back(m_waiters.front(), v);
+                m_waiters.pop_front();
+                m_num_waiters--;
+            }
+        }
+        for (auto const & p : ready) {
+            promise_resolve(mk_option_some(p.second), p.first);
+            dec(p.first);
+        }
+    }
+
+public:
+    /* `capacity == 0` means unbounded */
+    explicit channel(size_t capacity) {
+        if (capacity > 0)
+            m_bounded = new bounded_queue(capacity);
+        else
+            m_unbounded = new unbounded_queue();
+    }
+
+    ~channel() {
+        object * v;
+        while (try_pop(v))
+            dec(v);
+        for (object * p : m_waiters)
+            dec(p);
+        delete m_bounded;
+        delete m_unbounded;
+    }
+
+    /* Consumes `v`. Returns `false` if the channel is closed, or if it is full and `block` is false. */
+    bool send(object * v, bool block) {
+        /* Like for multi-threaded references, values must be marked since they may be received by any thread. */
+        mark_mt(v);
+        if (m_closed.load()) {
+            dec(v);
+            return false;
+        }
+        if (!try_push(v)) {
+            if (!block) {
+                dec(v);
+                return false;
+            }
+            unique_lock<mutex> lock(m_space_mutex);
+            m_num_blocked_senders++;
+            while (!try_push(v)) {
+                if (m_closed.load()) {
+                    m_num_blocked_senders--;
+                    lock.unlock();
+                    dec(v);
+                    return false;
+                }
+                m_space_cv.wait(lock);
+            }
+            m_num_blocked_senders--;
+        }
+        wake_waiters();
+        return true;
+    }
+
+    /* Returns `Option α` */
+    obj_res try_recv() {
+        object * v;
+        if (try_pop(v))
+            return mk_option_some(v);
+        return mk_option_none();
+    }
+
+    /* Returns `Task (Option α)` */
+    obj_res recv() {
+        object * v;
+        if (try_pop(v))
+            return task_pure(mk_option_some(v));
+        unique_lock<mutex> lock(m_waiters_mutex);
+        m_num_waiters++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (try_pop(v)) {
+            m_num_waiters--;
+            return task_pure(mk_option_some(v));
+        }
+        if (m_closed.load()) {
+            m_num_waiters--;
+            return task_pure(mk_option_none());
+        }
+        object * promise = promise_new();
+        inc(promise);
+        m_waiters.push_back(promise);
+        /* the result task of a promise is the promise itself */
+        return promise;
+    }
+
+    void close() {
+        m_closed.store(true);
+        {
+            lock_guard<mutex> _(m_space_mutex);
+            m_space_cv.notify_all();
+        }
+        std::vector<std::pair<object *, object *>> ready;
+        {
+            lock_guard<mutex> _(m_waiters_mutex);
+            for (object * p : m_waiters) {
+                object * v;
+                ready.emplace_back(p, try_pop(v) ? mk_option_some(v) : mk_option_none());
+            }
+            m_waiters.clear();
+            m_num_waiters = 0;
+        }
+        for (auto const & p : ready) {
+            promise_resolve(p.second, p.first);
+            dec(p.first);
+        }
+    }
+};
+
+static lean_external_class * g_channel_external_class = nullptr;
+static void channel_finalizer(void * h) {
+    delete static_cast<channel *>(h);
+}
+/* All values in a channel are already marked as multi-threaded. */
+static void channel_foreach(void *, b_obj_arg) {}
+
+static channel * channel_get(b_obj_arg ch) {
+    return static_cast<channel *>(lean_get_external_data(ch));
+}
+
+/* NativeChannel.new (capacity : Option Nat) : BaseIO (NativeChannel α) */
+extern "C" LEAN_EXPORT obj_res lean_io_native_channel_new(b_obj_arg capacity, obj_arg) {
+    size_t cap = 0;
+    if (!lean_is_scalar(capacity)) {
+        object * n = cnstr_get(capacity, 0);
+        if (!lean_is_scalar(n))
+            return io_result_mk_error("NativeChannel.new: capacity is too big");
+        cap = std::max<size_t>(unbox(n), 1);
+    }
+    return io_result_mk_ok(lean_alloc_external(g_channel_external_class, new channel(cap)));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_native_channel_send(b_obj_arg ch, obj_arg v, obj_arg) {
+    channel_get(ch)->send(v, /* block */ true);
+    return io_result_mk_ok(box(0));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_native_channel_try_send(b_obj_arg ch, obj_arg v, obj_arg) {
+    return io_result_mk_ok(box(channel_get(ch)->send(v, /* block */ false)));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_native_channel_try_recv(b_obj_arg ch, obj_arg) {
+    return io_result_mk_ok(channel_get(ch)->try_recv());
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_native_channel_recv(b_obj_arg ch, obj_arg) {
+    return io_result_mk_ok(channel_get(ch)->recv());
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_native_channel_close(b_obj_arg ch, obj_arg) {
+    channel_get(ch)->close();
+    return io_result_mk_ok(box(0));
+}
+
+void initialize_channel() {
+    g_channel_external_class = lean_register_external_class(channel_finalizer, channel_foreach);
+}
+
+void finalize_channel() {
+}
+}
@@ -0,0 +1,198 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <atomic>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <lean/lean.h>
+#include "runtime/concurrent_map.h"
+#include "runtime/io.h"
+#include "runtime/object.h"
+#include "runtime/thread.h"
+
+#define LEAN_CONCURRENT_MAP_SHARDS 64
+
+namespace lean {
+/* Hash map from Lean objects to Lean objects that can be shared by multiple threads, using the hash and equality
+   functions given on construction. Entries are distributed over independently locked shards by their hash, so that
+   threads accessing different keys rarely contend. The equality function is called while holding the lock of a
+   shard and thus must not access the map.
+
+   Like values stored in multi-threaded references, keys and values are marked as multi-threaded on insertion. */
+class concurrent_map {
+    typedef std::unordered_multimap<uint64_t, std::pair<object *, object *>> entries;
+    struct shard {
+        mutex   m_mutex;
+        entries m_entries;
+        char    m_pad[64];
+    };
+    object *            m_hash_fn;
+    object *            m_eq_fn;
+    shard               m_shards[LEAN_CONCURRENT_MAP_SHARDS];
+    std::atomic<size_t> m_size{0};
+
+    uint64_t hash(b_obj_arg k) {
+        inc(m_hash_fn); inc(k);
+        object * r = apply_1(m_hash_fn, k);
+        uint64_t h = lean_unbox_uint64(r);
+        dec(r);
+        return h;
+    }
+
+    bool eq(b_obj_arg k1, b_obj_arg k2) {
+        inc(m_eq_fn); inc(k1); inc(k2);
+        return unbox(apply_2(m_eq_fn, k1, k2)) != 0;
+    }
+
+    shard & get_shard(uint64_t h) {
+        return m_shards[(h ^ (h >> 32)) % LEAN_CONCURRENT_MAP_SHARDS];
+    }
+
+    entries::iterator find(shard & s, uint64_t h, b_obj_arg k) {
+        auto range = s.m_entries.equal_range(h);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (eq(it->second.first, k))
+                return it;
+        }
+        return s.m_entries.end();
+    }
+
+public:
+    concurrent_map(obj_arg hash_fn, obj_arg eq_fn):m_hash_fn(hash_fn), m_eq_fn(eq_fn) {}
+
+    ~concurrent_map() {
+        for (shard & s : m_shards) {
+            for (auto const & e : s.m_entries) {
+                dec(e.second.first);
+                dec(e.second.second);
+            }
+        }
+        dec(m_hash_fn);
+        dec(m_eq_fn);
+    }
+
+    /* Returns `Option β` */
+    obj_res get(b_obj_arg k) {
+        uint64_t h = hash(k);
+        shard & s  = get_shard(h);
+        lock_guard<mutex> _(s.m_mutex);
+        auto it = find(s, h, k);
+        if (it == s.m_entries.end())
+            return mk_option_none();
+        inc(it->second.second);
+        return mk_option_some(it->second.second);
+    }
+
+    /* Consumes `k` and `v`. If `only_if_absent` is true and there is an entry for `k` already, it is not replaced.
+       Returns the value of `k` after the operation. */
+    obj_res insert(obj_arg k, obj_arg v, bool only_if_absent) {
+        mark_mt(k);
+        mark_mt(v);
+        uint64_t h = hash(k);
+        shard & s  = get_shard(h);
+        object * unused_key = nullptr;
+        object * unused_val = nullptr;
+        object * r;
+        {
+            lock_guard<mutex> _(s.m_mutex);
+            auto it = find(s, h, k);
+            if (it == s.m_entries.end()) {
+                s.m_entries.emplace(h, std::make_pair(k, v));
+                m_size++;
+                r = v;
+            } else if (only_if_absent) {
+                unused_key = k;
+                unused_val = v;
+                r = it->second.second;
+            } else {
+                unused_key = k;
+                unused_val = it->second.second;
+                it->second.second = v;
+                r = v;
+            }
+            inc(r);
+        }
+        /* free replaced objects outside of the lock, which may run arbitrary finalizers */
+        if (unused_key) dec(unused_key);
+        if (unused_val) dec(unused_val);
+        return r;
+    }
+
+    void erase(b_obj_arg k) {
+        uint64_t h = hash(k);
+        shard & s  = get_shard(h);
+        std::pair<object *, object *> e(nullptr, nullptr);
+        {
+            lock_guard<mutex> _(s.m_mutex);
+            auto it = find(s, h, k);
+            if (it == s.m_entries.end())
+                return;
+            e = it->second;
+            s.m_entries.erase(it);
+            m_size--;
+        }
+        dec(e.first);
+        dec(e.second);
+    }
+
+    size_t size() const { return m_size.load(); }
+
+    void for_each_fn(b_obj_arg fn) {
+        inc(fn); inc(m_hash_fn);
+        apply_1(fn, m_hash_fn);
+        inc(fn); inc(m_eq_fn);
+        apply_1(fn, m_eq_fn);
+    }
+};
+
+static lean_external_class * g_concurrent_map_external_class = nullptr;
+static void concurrent_map_finalizer(void * h) {
+    delete static_cast<concurrent_map *>(h);
+}
+/* Entries are already marked as multi-threaded on insertion, so we only need to visit the functions. */
+static void concurrent_map_foreach(void * h, b_obj_arg fn) {
+    static_cast<concurrent_map *>(h)->for_each_fn(fn);
+}
+
+static concurrent_map * concurrent_map_get(b_obj_arg m) {
+    return static_cast<concurrent_map *>(lean_get_external_data(m));
+}
+
+/* ConcurrentHashMap.mkCore (hash : α → UInt64) (beq : α → α → Bool) : BaseIO (ConcurrentHashMap α β) */
+extern "C" LEAN_EXPORT obj_res lean_io_concurrent_hash_map_new(obj_arg hash_fn, obj_arg eq_fn, obj_arg) {
+    mark_mt(hash_fn);
+    mark_mt(eq_fn);
+    return io_result_mk_ok(lean_alloc_external(g_concurrent_map_external_class, new concurrent_map(hash_fn, eq_fn)));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_concurrent_hash_map_get(b_obj_arg m, b_obj_arg k, obj_arg) {
+    return io_result_mk_ok(concurrent_map_get(m)->get(k));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_concurrent_hash_map_insert(b_obj_arg m, obj_arg k, obj_arg v, obj_arg) {
+    dec(concurrent_map_get(m)->insert(k, v, /* only_if_absent */ false));
+    return io_result_mk_ok(box(0));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_concurrent_hash_map_insert_if_absent(b_obj_arg m, obj_arg k, obj_arg v, obj_arg) {
+    return io_result_mk_ok(concurrent_map_get(m)->insert(k, v, /* only_if_absent */ true));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_concurrent_hash_map_erase(b_obj_arg m, b_obj_arg k, obj_arg) {
+    concurrent_map_get(m)->erase(k);
+    return io_result_mk_ok(box(0));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_concurrent_hash_map_size(b_obj_arg m, obj_arg) {
+    return io_result_mk_ok(usize_to_nat(concurrent_map_get(m)->size()));
+}
+
+void initialize_concurrent_map() {
+    g_concurrent_map_external_class = lean_register_external_class(concurrent_map_finalizer, concurrent_map_foreach);
+}
+
+void finalize_concurrent_map() {
+}
+}
@@ -0,0 +1,10 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+
+namespace lean {
+void initialize_concurrent_map();
+void finalize_concurrent_map();
+}
@@ -4,55 +4,94 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <cstring>
 #include "runtime/hash.h"
 
 namespace lean {
 
 //-----------------------------------------------------------------------------
-// MurmurHash2, 64-bit versions, by Austin Appleby
-// https://sites.google.com/site/murmurhash/
-static uint64 MurmurHash64A(void const * key, size_t len, uint64 seed) {
-    const uint64 m = 0xc6a4a7935bd1e995;
-    const int r = 47;
+// wyhash (final version 4), by Wang Yi
+// https://github.com/wangyi-fudan/wyhash
+// It consumes 48 bytes per iteration using three independent 64x64->128-bit multiplications,
+// and inputs of at most 16 bytes are hashed without any loop.
+// Remark: like the previous implementation (MurmurHash64A), words are read in native byte order,
+// so hash values of the same input may differ between little- and big-endian machines.
 
-    uint64 h = seed ^ (len * m);
-
-    const uint64 * data = (const uint64 *)key;
-    const uint64 * end = data + (len/8);
+static inline void wymum(uint64 & a, uint64 & b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = a;
+    r *= b;
+    a = static_cast<uint64>(r);
+    b = static_cast<uint64>(r >> 64);
+#else
+    uint64 ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+    uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+    uint64 c = t < rl;
+    uint64 lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64 hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    a = lo;
+    b = hi;
+#endif
+}
 
-    while (data != end) {
-        uint64 k = *data++;
+static inline uint64 wymix(uint64 a, uint64 b) {
+    wymum(a, b);
+    return a ^ b;
+}
 
-        k *= m;
-        k ^= k >> r;
-        k *= m;
+static inline uint64 wyr8(unsigned char const * p) { uint64 v; memcpy(&v, p, 8); return v; }
+static inline uint64 wyr4(unsigned char const * p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint64 wyr3(unsigned char const * p, size_t k) {
+    return (static_cast<uint64>(p[0]) << 16) | (static_cast<uint64>(p[k >> 1]) << 8) | p[k - 1];
+}
 
-        h ^= k;
-        h *= m;
+static uint64 wyhash(unsigned char const * p, size_t len, uint64 seed) {
+    const uint64 s0 = 0x2d358dccaa6c78a5ull;
+    const uint64 s1 = 0x8bb84b93962eacc9ull;
+    const uint64 s2 = 0x4b33a62ed433d4a3ull;
+    const uint64 s3 = 0x4d5a2da51de1aa47ull;
+    seed ^= wymix(seed ^ s0, s1);
+    uint64 a, b;
+    if (LEAN_LIKELY(len <= 16)) {
+        if (LEAN_LIKELY(len >= 4)) {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (LEAN_LIKELY(len > 0)) {
+            a = wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (LEAN_UNLIKELY(i >= 48)) {
+            uint64 see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ s1, wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ s2, wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ s3, wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (LEAN_LIKELY(i >= 48));
+            seed ^= see1 ^ see2;
+        }
+        while (LEAN_UNLIKELY(i > 16)) {
+            seed = wymix(wyr8(p) ^ s1, wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
     }
-
-    const unsigned char * data2 = (const unsigned char *) data;
-
-    switch (len & 7) {
-    case 7: h ^= uint64(data2[6]) << 48;
-    case 6: h ^= uint64(data2[5]) << 40;
-    case 5: h ^= uint64(data2[4]) << 32;
-    case 4: h ^= uint64(data2[3]) << 24;
-    case 3: h ^= uint64(data2[2]) << 16;
-    case 2: h ^= uint64(data2[1]) << 8;
-    case 1: h ^= uint64(data2[0]);
-            h *= m;
-    };
-
-    h ^= h >> r;
-    h *= m;
-    h ^= h >> r;
-
-    return h;
+    a ^= s1;
+    b ^= seed;
+    wymum(a, b);
+    return wymix(a ^ s0 ^ len, b ^ s1);
 }
 
 uint64 hash_str(size_t len, unsigned char const * str, uint64 init_value) {
-    return MurmurHash64A(str, len, init_value);
+    return wyhash(str, len, init_value);
 }
 
 }
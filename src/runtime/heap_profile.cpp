@@ -0,0 +1,336 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <limits>
+#include "runtime/heap_profile.h"
+#include "runtime/thread.h"
+#include "runtime/utf8.h"
+
+#ifdef __GLIBC__
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#endif
+
+#define LEAN_DEFAULT_HEAP_PROFILE_RATE 512*1024 // 512 Kb
+#define LEAN_HEAP_PROFILE_MAX_DEPTH    64
+
+namespace lean {
+bool g_heap_profile_enabled = false;
+std::atomic<uint8_t> g_heap_profile_filter[LEAN_HEAP_PROFILE_FILTER_SIZE];
+static std::string * g_heap_profile_fname = nullptr;
+static double g_heap_profile_rate = LEAN_DEFAULT_HEAP_PROFILE_RATE;
+LEAN_THREAD_VALUE(uint64_t, g_heap_profile_rng, 0);
+
+/* Estimated number of objects and bytes represented by the samples of a stack */
+struct heap_profile_stats {
+    double m_alloc_objs{0};
+    double m_alloc_bytes{0};
+    double m_live_objs{0};
+    double m_live_bytes{0};
+};
+
+struct heap_profile_live_sample {
+    heap_profile_stats * m_stats;
+    double               m_objs;
+    double               m_bytes;
+};
+
+struct heap_profile_state {
+    mutex                                                 m_mutex;
+    std::map<std::vector<void *>, heap_profile_stats>     m_stacks;
+    std::unordered_map<void *, heap_profile_live_sample>  m_live;
+};
+static heap_profile_state * g_heap_profile = nullptr;
+
+/* Uniformly distributed in (0, 1] */
+static double heap_profile_random() {
+    uint64_t & x = g_heap_profile_rng;
+    if (x == 0)
+        x = reinterpret_cast<uint64_t>(&x) ^ static_cast<uint64_t>(chrono::steady_clock::now().time_since_epoch().count()) ^ 1;
+    /* xorshift64* */
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    return ((x * 2685821657736338717ull >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+int64_t heap_profile_next_sample_interval() {
+    if (!g_heap_profile_enabled)
+        return std::numeric_limits<int64_t>::max();
+    /* The distance between two events of a Poisson process is exponentially distributed */
+    return static_cast<int64_t>(-std::log(heap_profile_random()) * g_heap_profile_rate) + 1;
+}
+
+static void heap_profile_remove_live(std::unordered_map<void *, heap_profile_live_sample>::iterator it) {
+    heap_profile_live_sample & s = it->second;
+    s.m_stats->m_live_objs  -= s.m_objs;
+    s.m_stats->m_live_bytes -= s.m_bytes;
+    std::atomic<uint8_t> & f = g_heap_profile_filter[heap_profile_filter_idx(it->first)];
+    uint8_t n = f.load(std::memory_order_relaxed);
+    if (n != 255)
+        f.store(n - 1, std::memory_order_relaxed);
+    g_heap_profile->m_live.erase(it);
+}
+
+void heap_profile_record_alloc(void * o, size_t sz) {
+    std::vector<void *> stack;
+#ifdef __GLIBC__
+    void * buf[LEAN_HEAP_PROFILE_MAX_DEPTH + 2];
+    int n = backtrace(buf, LEAN_HEAP_PROFILE_MAX_DEPTH + 2);
+    /* skip this function and the allocator function calling it */
+    if (n > 2)
+        stack.assign(buf + 2, buf + n);
+#endif
+    /* An object of size `sz` is sampled with probability `1 - exp(-sz/rate)`, so it stands for the inverse of that
+       many objects of the same size. */
+    double objs  = 1.0 / (1.0 - std::exp(-static_cast<double>(sz) / g_heap_profile_rate));
+    double bytes = objs * sz;
+    lock_guard<mutex> _(g_heap_profile->m_mutex);
+    heap_profile_stats & stats = g_heap_profile->m_stacks[stack];
+    stats.m_alloc_objs  += objs;
+    stats.m_alloc_bytes += bytes;
+    stats.m_live_objs   += objs;
+    stats.m_live_bytes  += bytes;
+    auto it = g_heap_profile->m_live.find(o);
+    if (it != g_heap_profile->m_live.end())
+        heap_profile_remove_live(it);
+    g_heap_profile->m_live.insert(std::make_pair(o, heap_profile_live_sample{&stats, objs, bytes}));
+    std::atomic<uint8_t> & f = g_heap_profile_filter[heap_profile_filter_idx(o)];
+    uint8_t c = f.load(std::memory_order_relaxed);
+    if (c != 255)
+        f.store(c + 1, std::memory_order_relaxed);
+}
+
+bool heap_profile_record_free_core(void * o) {
+    lock_guard<mutex> _(g_heap_profile->m_mutex);
+    auto it = g_heap_profile->m_live.find(o);
+    if (it == g_heap_profile->m_live.end())
+        return false;
+    heap_profile_remove_live(it);
+    return true;
+}
+
+static bool read_hex(char const * s, unsigned n, unsigned & r) {
+    r = 0;
+    for (unsigned i = 0; i < n; i++) {
+        char c = s[i];
+        unsigned d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else return false;
+        r = 16*r + d;
+    }
+    return true;
+}
+
+/* Best-effort inverse of `Name.mangle` (see `Lean.Compiler.NameMangling`) applied to the part of a symbol after `l_`.
+   The encoding is ambiguous in rare cases such as a name component starting with `x` followed by two hex digits. */
+static std::string demangle_lean_name(char const * s) {
+    std::string r;
+    while (*s) {
+        unsigned code;
+        if (s[0] != '_') {
+            r += *s++;
+        } else if (s[1] == '_') {
+            r += '_';
+            s += 2;
+        } else if (s[1] == 'x' && read_hex(s + 2, 2, code)) {
+            push_unicode_scalar(r, code);
+            s += 4;
+        } else if (s[1] == 'u' && read_hex(s + 2, 4, code)) {
+            push_unicode_scalar(r, code);
+            s += 6;
+        } else if (s[1] == 'U' && read_hex(s + 2, 8, code)) {
+            push_unicode_scalar(r, code);
+            s += 10;
+        } else {
+            /* component separator; numeric components are of the form `_<digits>_` */
+            char const * e = s + 1;
+            while (*e >= '0' && *e <= '9') e++;
+            r += '.';
+            if (e != s + 1 && *e == '_') {
+                r.append(s + 1, e);
+                s = e + 1;
+            } else {
+                s++;
+            }
+        }
+    }
+    return r;
+}
+
+static std::string heap_profile_symbolize(void * pc) {
+#ifdef __GLIBC__
+    Dl_info info;
+    /* `pc` is a return address, which may already belong to the next function */
+    if (dladdr(static_cast<char *>(pc) - 1, &info) && info.dli_sname) {
+        char const * n = info.dli_sname;
+        if (strncmp(n, "l_", 2) == 0)
+            return demangle_lean_name(n + 2);
+        int status;
+        if (char * d = abi::__cxa_demangle(n, nullptr, nullptr, &status)) {
+            std::string r(d);
+            free(d);
+            return r;
+        }
+        return n;
+    }
+#endif
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%p", pc);
+    return buf;
+}
+
+/* Minimal encoder for the protocol buffer messages of the pprof format, see
+   https://github.com/google/pprof/blob/main/proto/profile.proto */
+class pprof_message {
+    std::string m_buf;
+    void varint(uint64_t v) {
+        while (v >= 0x80) {
+            m_buf += static_cast<char>((v & 0x7f) | 0x80);
+            v >>= 7;
+        }
+        m_buf += static_cast<char>(v);
+    }
+public:
+    pprof_message & add_int(unsigned field, uint64_t v) {
+        varint(field << 3);
+        varint(v);
+        return *this;
+    }
+    pprof_message & add_bytes(unsigned field, std::string const & s) {
+        varint((field << 3) | 2);
+        varint(s.size());
+        m_buf += s;
+        return *this;
+    }
+    pprof_message & add_message(unsigned field, pprof_message const & m) { return add_bytes(field, m.m_buf); }
+    pprof_message & add_packed(unsigned field, std::vector<uint64_t> const & vs) {
+        pprof_message m;
+        for (uint64_t v : vs) m.varint(v);
+        return add_message(field, m);
+    }
+    std::string const & data() const { return m_buf; }
+};
+
+class pprof_profile {
+    pprof_message                               m_profile;
+    std::unordered_map<std::string, uint64_t>  m_strings;
+    std::unordered_map<std::string, uint64_t>  m_functions;
+    std::unordered_map<void *, uint64_t>       m_locations;
+public:
+    pprof_profile() { str(""); }
+
+    uint64_t str(std::string const & s) {
+        auto it = m_strings.find(s);
+        if (it != m_strings.end())
+            return it->second;
+        uint64_t id = m_strings.size();
+        m_strings[s] = id;
+        m_profile.add_bytes(6, s);
+        return id;
+    }
+
+    pprof_message value_type(char const * type, char const * unit) {
+        pprof_message m;
+        m.add_int(1, str(type)).add_int(2, str(unit));
+        return m;
+    }
+
+    uint64_t location(void * pc) {
+        auto it = m_locations.find(pc);
+        if (it != m_locations.end())
+            return it->second;
+        std::string name = heap_profile_symbolize(pc);
+        uint64_t fn;
+        auto fit = m_functions.find(name);
+        if (fit != m_functions.end()) {
+            fn = fit->second;
+        } else {
+            fn = m_functions.size() + 1;
+            m_functions[name] = fn;
+            pprof_message f;
+            f.add_int(1, fn).add_int(2, str(name)).add_int(3, str(name));
+            m_profile.add_message(5, f);
+        }
+        uint64_t id = m_locations.size() + 1;
+        m_locations[pc] = id;
+        pprof_message line;
+        line.add_int(1, fn);
+        pprof_message loc;
+        loc.add_int(1, id).add_int(3, reinterpret_cast<uint64_t>(pc)).add_message(4, line);
+        m_profile.add_message(4, loc);
+        return id;
+    }
+
+    pprof_message & profile() { return m_profile; }
+};
+
+bool write_heap_profile(char const * fname) {
+    if (!g_heap_profile)
+        return false;
+    pprof_profile p;
+    p.profile().add_message(1, p.value_type("alloc_objects", "count"));
+    p.profile().add_message(1, p.value_type("alloc_space", "bytes"));
+    p.profile().add_message(1, p.value_type("inuse_objects", "count"));
+    p.profile().add_message(1, p.value_type("inuse_space", "bytes"));
+    {
+        lock_guard<mutex> _(g_heap_profile->m_mutex);
+        for (auto const & e : g_heap_profile->m_stacks) {
+            std::vector<uint64_t> locs;
+            for (void * pc : e.first) locs.push_back(p.location(pc));
+            heap_profile_stats const & s = e.second;
+            std::vector<uint64_t> values;
+            for (double v : {s.m_alloc_objs, s.m_alloc_bytes, s.m_live_objs, s.m_live_bytes})
+                values.push_back(v > 0 ? static_cast<uint64_t>(std::llround(v)) : 0);
+            pprof_message sample;
+            sample.add_packed(1, locs).add_packed(2, values);
+            p.profile().add_message(2, sample);
+        }
+    }
+    /* drop the frames of the allocator */
+    p.profile().add_int(7, p.str("^(lean_alloc|lean::alloc|lean::heap_profile).*"));
+    p.profile().add_message(11, p.value_type("space", "bytes"));
+    p.profile().add_int(12, static_cast<uint64_t>(g_heap_profile_rate));
+    p.profile().add_int(14, p.str("inuse_space"));
+    FILE * out = fopen(fname, "wb");
+    if (!out)
+        return false;
+    std::string const & data = p.profile().data();
+    bool ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+    return fclose(out) == 0 && ok;
+}
+
+static void write_heap_profile_at_exit() {
+    if (!write_heap_profile(g_heap_profile_fname->c_str()))
+        fprintf(stderr, "failed to write heap profile to '%s'\n", g_heap_profile_fname->c_str());
+}
+
+void initialize_heap_profile() {
+#ifndef LEAN_EMSCRIPTEN
+    char const * fname = std::getenv("LEAN_HEAP_PROFILE");
+    if (!fname || !*fname)
+        return;
+    if (char const * rate = std::getenv("LEAN_HEAP_PROFILE_RATE")) {
+        double r = std::strtod(rate, nullptr);
+        if (r >= 1)
+            g_heap_profile_rate = r;
+    }
+    g_heap_profile_fname   = new std::string(fname);
+    /* Never deleted, as objects may still be freed after the profile has been written. */
+    g_heap_profile         = new heap_profile_state();
+    g_heap_profile_enabled = true;
+    std::atexit(write_heap_profile_at_exit);
+#endif
+}
+}
@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace lean {
+/* Sampling heap profiler. It is enabled by setting `LEAN_HEAP_PROFILE` to the name of the output file, which is
+   written at exit in the pprof format (view it using e.g. `pprof -http=: file` or https://speedscope.app), and
+   reports allocated and live bytes by native stack, with Lean functions displayed by their declaration names.
+
+   Allocations are sampled as a Poisson process on allocated bytes with a mean sampling interval of
+   `LEAN_HEAP_PROFILE_RATE` bytes (default 512 KiB), so the overhead when enabled mostly depends on the number of
+   allocated bytes, and is a counter decrement per allocation plus a table lookup per deallocation. Objects of all
+   sizes allocated through the runtime allocator are profiled; an allocation is sampled at most once even if it is
+   larger than the next sampling interval. */
+
+#define LEAN_HEAP_PROFILE_FILTER_SIZE (1 << 16)
+
+extern bool g_heap_profile_enabled;
+/* Approximate set of the addresses of sampled objects that have not been freed yet; each entry counts the objects
+   hashing to it, saturating at 255. */
+extern std::atomic<uint8_t> g_heap_profile_filter[LEAN_HEAP_PROFILE_FILTER_SIZE];
+
+inline bool heap_profile_enabled() { return g_heap_profile_enabled; }
+
+inline size_t heap_profile_filter_idx(void * o) {
+    size_t h = reinterpret_cast<size_t>(o) >> 3;
+    return (h ^ (h >> 16)) & (LEAN_HEAP_PROFILE_FILTER_SIZE - 1);
+}
+
+/* Number of bytes to be allocated by the current thread until the next sample, which is effectively infinite if
+   the profiler is disabled. */
+int64_t heap_profile_next_sample_interval();
+/* Record the allocation of object `o` of `sz` bytes, which was chosen by the sampler. Must be called directly
+   by the allocator. */
+void heap_profile_record_alloc(void * o, size_t sz);
+bool heap_profile_record_free_core(void * o);
+/* Must be called when freeing any object. Returns `true` if `o` was sampled. */
+inline bool heap_profile_record_free(void * o) {
+    if (g_heap_profile_enabled && g_heap_profile_filter[heap_profile_filter_idx(o)].load(std::memory_order_relaxed))
+        return heap_profile_record_free_core(o);
+    return false;
+}
+
+/* Write the current profile to `fname`. Returns `false` if the file could not be written. */
+bool write_heap_profile(char const * fname);
+
+/* Must be called before `initialize_alloc`. */
+void initialize_heap_profile();
+}
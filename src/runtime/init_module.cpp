@@ -12,16 +12,26 @@ Author: Leonardo de Moura
 #include "runtime/stack_overflow.h"
 #include "runtime/process.h"
 #include "runtime/mutex.h"
+#include "runtime/channel.h"
+#include "runtime/concurrent_map.h"
+#include "runtime/string_builder.h"
+#include "runtime/trace_event.h"
+#include "runtime/heap_profile.h"
 #include "runtime/init_module.h"
 
 namespace lean {
 extern "C" LEAN_EXPORT void lean_initialize_runtime_module() {
+    initialize_heap_profile();
     initialize_alloc();
     initialize_debug();
+    initialize_trace_event();
     initialize_object();
     initialize_io();
     initialize_thread();
     initialize_mutex();
+    initialize_channel();
+    initialize_concurrent_map();
+    initialize_string_builder();
     initialize_process();
     initialize_stack_overflow();
 }
@@ -31,10 +41,14 @@ void initialize_runtime_module() {
 void finalize_runtime_module() {
     finalize_stack_overflow();
     finalize_process();
+    finalize_string_builder();
+    finalize_concurrent_map();
+    finalize_channel();
     finalize_mutex();
     finalize_thread();
     finalize_io();
     finalize_object();
+    finalize_trace_event();
     finalize_debug();
     finalize_alloc();
 }
@@ -10,7 +10,6 @@ Author: Leonardo de Moura
 #include "runtime/exception.h"
 #include "runtime/memory.h"
 #include "lean/lean.h"
-#include "util/io.h"
 
 namespace lean {
 LEAN_THREAD_VALUE(size_t, g_max_heartbeat, 0);
@@ -36,24 +35,35 @@ void throw_heartbeat_exception() {
 
 void check_heartbeat() {
     inc_heartbeat();
-    if (g_max_heartbeat > 0 && g_heartbeat > g_max_heartbeat)
+    /* Same as `g_max_heartbeat > 0 && g_heartbeat > g_max_heartbeat` (`g_heartbeat` is positive after the increment),
+       but with a single branch: if `g_max_heartbeat` is 0, the left-hand side wraps around to the maximum value. */
+    if (g_max_heartbeat - 1 < g_heartbeat - 1)
         throw_heartbeat_exception();
 }
 
-LEAN_THREAD_VALUE(lean_object *, g_cancel_tk, nullptr);
+/* Address of the value of the `IO.Ref Bool` inside the current `IO.CancelToken`, resolved once in `scope_cancel_tk`
+   so that `check_interrupted` is a single load instead of a call into `CancelToken.isSet`. */
+LEAN_THREAD_VALUE(lean_object **, g_cancel_flag, nullptr);
 
-LEAN_EXPORT scope_cancel_tk::scope_cancel_tk(lean_object * o):flet<lean_object *>(g_cancel_tk, o) {}
+static lean_object ** get_cancel_flag(lean_object * cancel_tk) {
+    if (cancel_tk == nullptr)
+        return nullptr;
+    /* `IO.CancelToken` is a structure containing only the reference, which may or may not be unboxed */
+    lean_object * ref = lean_is_ref(cancel_tk) ? cancel_tk : lean_ctor_get(cancel_tk, 0);
+    return &lean_to_ref(ref)->m_value;
+}
 
-/* CancelToken.isSet : @& IO.CancelToken → BaseIO Bool */
-extern "C" lean_obj_res lean_io_cancel_token_is_set(b_lean_obj_arg cancel_tk, lean_obj_arg);
+LEAN_EXPORT scope_cancel_tk::scope_cancel_tk(lean_object * o):
+    flet<lean_object **>(g_cancel_flag, get_cancel_flag(o)) {}
 
 void check_interrupted() {
-    if (g_cancel_tk) {
-        inc_ref(g_cancel_tk);
-        if (get_io_scalar_result<bool>(lean_io_cancel_token_is_set(g_cancel_tk, lean_io_mk_world())) &&
-            !std::uncaught_exception()) {
+    if (g_cancel_flag) {
+        /* The reference may be written concurrently and may even be temporarily empty (`nullptr`) while another thread
+           reads it, see `lean_st_ref_get`. We only need to eventually observe `true`. */
+        lean_object * v = atomic_load_explicit(reinterpret_cast<atomic<lean_object *> *>(g_cancel_flag),
+                                              memory_order_relaxed);
+        if (v == lean_box(true) && !std::uncaught_exception())
             throw interrupted();
-        }
     }
 }
 
@@ -43,7 +43,7 @@ public:
 LEAN_EXPORT void check_heartbeat();
 
 /* Update the thread local `IO.CancelToken` (`nullptr` if unset) */
-class LEAN_EXPORT scope_cancel_tk : flet<lean_object *> {
+class LEAN_EXPORT scope_cancel_tk : flet<lean_object **> {
 public:
     LEAN_EXPORT scope_cancel_tk(lean_object *);
 };
@@ -151,7 +151,7 @@ extern "C" LEAN_EXPORT obj_res lean_get_set_stderr(obj_arg h, obj_arg /* w */) {
     return io_result_mk_ok(r);
 }
 
-static FILE * io_get_handle(lean_object * hfile) {
+FILE * io_get_handle(lean_object * hfile) {
     return static_cast<FILE *>(lean_get_external_data(hfile));
 }
 
@@ -1019,6 +1019,76 @@ extern "C" LEAN_EXPORT obj_res lean_st_ref_swap(b_obj_arg ref, obj_arg a, obj_ar
     }
 }
 
+/* Replace the value of `ref` with `desired` if it is pointer-equal to `expected`. Consumes `desired`, and returns
+   whether the value was replaced. The caller must own a reference to `expected`. */
+static bool st_ref_cas_core(b_obj_arg ref, b_obj_arg expected, obj_arg desired) {
+    if (ref_maybe_mt(ref)) {
+        /* See `lean_st_ref_set` */
+        mark_mt(desired);
+        atomic<object *> * val_addr = mt_ref_val_addr(ref);
+        while (true) {
+            object * val = expected;
+            if (val_addr->compare_exchange_weak(val, desired)) {
+                /* release the RC token of the ref, which cannot be the last one */
+                dec(expected);
+                return true;
+            } else if (val != nullptr) {
+                dec(desired);
+                return false;
+            }
+            /* The value is being read or taken by another thread, or the weak CAS failed spuriously. */
+        }
+    } else {
+        if (lean_to_ref(ref)->m_value != expected) {
+            dec(desired);
+            return false;
+        }
+        lean_assert(expected != nullptr);
+        dec(expected);
+        lean_to_ref(ref)->m_value = desired;
+        return true;
+    }
+}
+
+extern "C" LEAN_EXPORT obj_res lean_st_ref_cas(b_obj_arg ref, b_obj_arg expected, obj_arg desired, obj_arg) {
+    return io_result_mk_ok(box(st_ref_cas_core(ref, expected, desired)));
+}
+
+/* modifyGetLockFree {σ α β} (r : @& Ref σ α) (f : α → β × α) : ST σ β */
+extern "C" LEAN_EXPORT obj_res lean_st_ref_modify_get_lock_free(b_obj_arg ref, obj_arg f, obj_arg w) {
+    if (!ref_maybe_mt(ref)) {
+        object * val = lean_to_ref(ref)->m_value;
+        lean_assert(val != nullptr);
+        lean_to_ref(ref)->m_value = nullptr;
+        object * p = apply_1(f, val);
+        object * b = cnstr_get(p, 0);
+        object * a = cnstr_get(p, 1);
+        inc(b); inc(a); dec(p);
+        lean_to_ref(ref)->m_value = a;
+        return io_result_mk_ok(b);
+    }
+    /* Optimistically apply `f` to the current value and publish the result if the value has not changed in the
+       meantime, retrying otherwise. Unlike the `take`/`set` pair, other threads never observe an empty ref for
+       the duration of `f`. */
+    while (true) {
+        object * r   = lean_st_ref_get(ref, w);
+        object * val = io_result_get_value(r);
+        inc(val); dec(r);
+        inc(f); inc(val);
+        object * p = apply_1(f, val);
+        object * b = cnstr_get(p, 0);
+        object * a = cnstr_get(p, 1);
+        inc(b); inc(a); dec(p);
+        bool ok = st_ref_cas_core(ref, val, a);
+        dec(val);
+        if (ok) {
+            dec(f);
+            return io_result_mk_ok(b);
+        }
+        dec(b);
+    }
+}
+
 extern "C" LEAN_EXPORT obj_res lean_st_ref_ptr_eq(b_obj_arg ref1, b_obj_arg ref2, obj_arg) {
     // TODO(Leo): ref_maybe_mt
     bool r = lean_to_ref(ref1)->m_value == lean_to_ref(ref2)->m_value;
@@ -1054,6 +1124,15 @@ extern "C" LEAN_EXPORT obj_res lean_io_map_task(obj_arg f, obj_arg t, obj_arg pr
     return io_result_mk_ok(t2);
 }
 
+/*  mapTasks (f : List α → BaseIO β) (tasks : List (Task α)) (prio : Nat) (sync : Bool) : BaseIO (Task β) */
+extern "C" LEAN_EXPORT obj_res lean_io_map_tasks(obj_arg f, obj_arg tasks, obj_arg prio, uint8 sync,
+        obj_arg) {
+    object * c = lean_alloc_closure((void*)lean_io_bind_task_fn, 2, 1);
+    lean_closure_set(c, 0, f);
+    object * t = lean_task_map_list_core(c, tasks, lean_unbox(prio), sync, /* keep_alive */ true);
+    return io_result_mk_ok(t);
+}
+
 /*  bindTask (t : Task α) (f : α → BaseIO (Task β)) (prio : Nat) (sync : Bool) : BaseIO (Task β) */
 extern "C" LEAN_EXPORT obj_res lean_io_bind_task(obj_arg t, obj_arg f, obj_arg prio, uint8 sync,
         obj_arg) {
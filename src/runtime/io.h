@@ -16,6 +16,8 @@ LEAN_EXPORT lean_obj_res io_result_mk_error(char const * msg);
 LEAN_EXPORT lean_obj_res io_result_mk_error(std::string const & msg);
 inline lean_obj_res decode_io_error(int errnum, b_lean_obj_arg fname) { return lean_decode_io_error(errnum, fname); }
 LEAN_EXPORT lean_obj_res io_wrap_handle(FILE * hfile);
+/* Underlying file of an `IO.FS.Handle` */
+FILE * io_get_handle(lean_object * hfile);
 void initialize_io();
 void finalize_io();
 }
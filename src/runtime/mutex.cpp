@@ -4,6 +4,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Authors: Gabriel Ebner
 */
+#include <atomic>
 #include <lean/lean.h>
 #include "runtime/mutex.h"
 #include "runtime/io.h"
@@ -67,9 +68,41 @@ extern "C" LEAN_EXPORT obj_res lean_io_condvar_notify_all(b_obj_arg condvar, obj
     return io_result_mk_ok(box(0));
 }
 
+static lean_external_class * g_atomic_counter_external_class = nullptr;
+static void atomic_counter_finalizer(void * h) {
+    delete static_cast<std::atomic<uint64_t> *>(h);
+}
+static void atomic_counter_foreach(void *, b_obj_arg) {}
+
+static std::atomic<uint64_t> * atomic_counter_get(lean_object * c) {
+    return static_cast<std::atomic<uint64_t> *>(lean_get_external_data(c));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_atomic_counter_new(uint64_t v, obj_arg) {
+    return io_result_mk_ok(lean_alloc_external(g_atomic_counter_external_class, new std::atomic<uint64_t>(v)));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_atomic_counter_get(b_obj_arg c, obj_arg) {
+    return io_result_mk_ok(lean_box_uint64(atomic_counter_get(c)->load()));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_atomic_counter_set(b_obj_arg c, uint64_t v, obj_arg) {
+    atomic_counter_get(c)->store(v);
+    return io_result_mk_ok(box(0));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_atomic_counter_fetch_add(b_obj_arg c, uint64_t d, obj_arg) {
+    return io_result_mk_ok(lean_box_uint64(atomic_counter_get(c)->fetch_add(d)));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_atomic_counter_cas(b_obj_arg c, uint64_t expected, uint64_t desired, obj_arg) {
+    return io_result_mk_ok(box(atomic_counter_get(c)->compare_exchange_strong(expected, desired)));
+}
+
 void initialize_mutex() {
     g_basemutex_external_class = lean_register_external_class(basemutex_finalizer, basemutex_foreach);
     g_condvar_external_class = lean_register_external_class(condvar_finalizer, condvar_foreach);
+    g_atomic_counter_external_class = lean_register_external_class(atomic_counter_finalizer, atomic_counter_foreach);
 }
 
 void finalize_mutex() {
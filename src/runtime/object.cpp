@@ -8,6 +8,8 @@ Author: Leonardo de Moura
 #include <algorithm>
 #include <vector>
 #include <deque>
+#include <queue>
+#include <unordered_map>
 #include <cmath>
 #include <lean/lean.h>
 #include "runtime/object.h"
@@ -21,6 +23,7 @@ Author: Leonardo de Moura
 #include "runtime/buffer.h"
 #include "runtime/io.h"
 #include "runtime/hash.h"
+#include "runtime/trace_event.h"
 
 #ifdef __GLIBC__
 #include <execinfo.h>
@@ -122,11 +125,18 @@ extern "C" LEAN_EXPORT object * lean_sorry(uint8) {
     lean_unreachable();
 }
 
+static bool g_mt_rc_cache_enabled = false;
+static bool mt_rc_cache_inc(lean_object * o, unsigned n);
+
 extern "C" LEAN_EXPORT void lean_inc_ref_cold(lean_object * o) {
+    if (LEAN_UNLIKELY(g_mt_rc_cache_enabled) && mt_rc_cache_inc(o, 1))
+        return;
     std::atomic_fetch_sub_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_relaxed);
 }
 
 extern "C" LEAN_EXPORT void lean_inc_ref_n_cold(lean_object * o, unsigned n) {
+    if (LEAN_UNLIKELY(g_mt_rc_cache_enabled) && mt_rc_cache_inc(o, n))
+        return;
     std::atomic_fetch_sub_explicit(lean_get_rc_mt_addr(o), (int)n, std::memory_order_relaxed);
 }
 
@@ -160,6 +170,27 @@ static inline void lean_dealloc(lean_object * o, size_t sz) {
 #endif
 }
 
+/* Return the largest capacity `>= cap` of an object with a header of `hdr_sz` bytes and elements of `elem_sz`
+   bytes that fits into the memory the allocator reserves for capacity `cap`. */
+static inline size_t lean_alloc_capacity(size_t hdr_sz, size_t elem_sz, size_t cap) {
+#ifdef LEAN_SMALL_ALLOCATOR
+    return (alloc_size(hdr_sz + elem_sz*cap) - hdr_sz) / elem_sz;
+#else
+    return cap;
+#endif
+}
+
+/* Resize the exclusive object `o` of `old_sz` bytes, moving it only if necessary. */
+static inline lean_object * lean_realloc_object(lean_object * o, size_t old_sz, size_t new_sz) {
+#ifdef LEAN_SMALL_ALLOCATOR
+    return static_cast<lean_object*>(realloc_sized(o, old_sz, new_sz));
+#else
+    void * r = realloc(o, new_sz);
+    if (r == nullptr) lean_internal_panic_out_of_memory();
+    return static_cast<lean_object*>(r);
+#endif
+}
+
 extern "C" LEAN_EXPORT void lean_free_object(lean_object * o) {
     switch (lean_ptr_tag(o)) {
     case LeanArray:       return lean_dealloc(o, lean_array_byte_size(o));
@@ -299,20 +330,355 @@ static void lean_del_core(object * o, object * & todo) {
     }
 }
 
-extern "C" LEAN_EXPORT void lean_dec_ref_cold(lean_object * o) {
-    if (o->m_rc == 1 || std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_acq_rel) == -1) {
-#ifdef LEAN_LAZY_RC
-        push_back(g_to_free, o);
-#else
-        object * todo = nullptr;
+/* Deferred freeing of large object graphs, enabled by setting `LEAN_DEFERRED_FREE=1`.
+
+   Freeing an object graph normally happens synchronously on the thread that drops the last reference to its root.
+   In deferred mode, once more than `LEAN_FREE_PAUSE_MIN_OBJS` objects of a graph have been freed, the remaining
+   objects of a multi-threaded graph are handed to a background thread (all objects reachable from a
+   multi-threaded object are multi-threaded, so their reference counters can be safely updated there), while
+   the remaining objects of other graphs are freed in slices of at most `LEAN_FREE_BUDGET` (default 4096) objects
+   on the same thread: one slice whenever the thread frees another object, and all of them when a task manager
+   worker becomes idle, and at thread exit. Note that finalizers of external objects may then run later than usual.
+
+   In deferred mode, the durations of frees of graphs with more than `LEAN_FREE_PAUSE_MIN_OBJS` objects as well as
+   of deferred slices are recorded in a histogram reported by `lean --stats`. */
+#define LEAN_FREE_PAUSE_MIN_OBJS    64
+#define LEAN_DEFAULT_FREE_BUDGET    4096
+#define LEAN_NUM_FREE_PAUSE_BUCKETS 24
+
+/* Maximal number of objects freed in one slice, or 0 if deferred freeing is disabled. */
+static size_t g_free_budget = 0;
+/* Number of pauses whose duration in microseconds has `i` as its binary logarithm (rounded down) */
+static std::atomic<uint64_t> g_free_pauses[LEAN_NUM_FREE_PAUSE_BUCKETS];
+/* Dead objects of the current thread whose children have not been released yet */
+LEAN_THREAD_PTR(object, g_deferred_free);
+/* Whether `finalize_deferred_free` has been registered for the current thread */
+LEAN_THREAD_VALUE(bool, g_deferred_free_finalizer, false);
+
+/* Increment the bucket of `v` in the histogram `buckets` with buckets for the binary logarithms (rounded down) of
+   the values, the last bucket also containing all larger values. */
+static void add_to_log2_histogram(std::atomic<uint64_t> * buckets, unsigned num_buckets, uint64_t v) {
+    unsigned i = 0;
+    while (v > 1 && i + 1 < num_buckets) {
+        v >>= 1;
+        i++;
+    }
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+}
+
+static void display_log2_histogram(std::ostream & out, std::atomic<uint64_t> const * buckets, unsigned num_buckets,
+                                   char const * unit) {
+    for (unsigned i = 0; i < num_buckets; i++) {
+        if (uint64_t n = buckets[i].load(std::memory_order_relaxed)) {
+            std::string range = i == 0 ? "< 2" : std::to_string(1ull << i) + "-" + std::to_string(2ull << i);
+            range = range + " " + unit;
+            out << "  " << range << std::string(range.size() < 24 ? 24 - range.size() : 0, ' ') << n << "\n";
+        }
+    }
+}
+
+static void record_free_pause(chrono::steady_clock::time_point start) {
+    uint64_t us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    add_to_log2_histogram(g_free_pauses, LEAN_NUM_FREE_PAUSE_BUCKETS, us);
+}
+
+/* Free at most `budget` objects of `g_deferred_free`. */
+static void free_deferred_slice(size_t budget) {
+    object * & todo = g_deferred_free;
+    while (todo != nullptr && budget > 0) {
+        object * o = pop_back(todo);
+        lean_del_core(o, todo);
+        budget--;
+    }
+}
+
+static void finalize_deferred_free(void *) {
+    free_deferred_slice(SIZE_MAX);
+}
+
+#if defined(LEAN_MULTI_THREAD)
+/* Frees multi-threaded object graphs handed to it by other threads in deferred mode. */
+class reclaimer {
+    mutex                   m_mutex;
+    condition_variable      m_cv;
+    /* heads of lists linked by `set_next` */
+    std::vector<object *>   m_todo;
+    bool                    m_shutting_down{false};
+    std::unique_ptr<lthread> m_thread;
+
+    void run() {
+        save_stack_info(false);
+        if (trace_events_enabled()) set_trace_event_thread_name("reclaimer");
+        unique_lock<mutex> lock(m_mutex);
         while (true) {
-            lean_del_core(o, todo);
-            if (todo == nullptr)
+            if (m_todo.empty()) {
+                if (m_shutting_down)
+                    break;
+                m_cv.wait(lock);
+                continue;
+            }
+            object * todo = m_todo.back();
+            m_todo.pop_back();
+            lock.unlock();
+            while (todo != nullptr) {
+                object * o = pop_back(todo);
+                lean_del_core(o, todo);
+            }
+            release_empty_pages();
+            lock.lock();
+        }
+    }
+
+public:
+    reclaimer() { start(); }
+    ~reclaimer() { stop(); }
+
+    void start() {
+        unique_lock<mutex> lock(m_mutex);
+        if (m_thread)
+            return;
+        m_shutting_down = false;
+        m_thread.reset(new lthread([this]() { run(); }));
+    }
+
+    /* Free all pending graphs and stop the background thread. Graphs handed to a stopped reclaimer are rejected. */
+    void stop() {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            if (!m_thread)
                 return;
-            o = pop_back(todo);
+            m_shutting_down = true;
         }
+        m_cv.notify_one();
+        m_thread->join();
+        unique_lock<mutex> lock(m_mutex);
+        m_thread.reset();
+    }
+
+    /* Returns `false` if the reclaimer has been stopped, in which case the caller must free `todo` itself. */
+    bool add(object * todo) {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            if (m_shutting_down)
+                return false;
+            m_todo.push_back(todo);
+        }
+        m_cv.notify_one();
+        return true;
+    }
+};
+
+/* Started together with the task manager, as multi-threaded objects are mostly created by tasks. It is stopped
+   before the task manager is deleted, as freeing task objects accesses the task manager, but only deleted in
+   `finalize_object` since other threads may still try to hand graphs to it. */
+static reclaimer * g_reclaimer = nullptr;
+#endif
+
+static void init_reclaimer() {
+#if defined(LEAN_MULTI_THREAD)
+    if (g_free_budget == 0)
+        return;
+    if (g_reclaimer)
+        g_reclaimer->start();
+    else
+        g_reclaimer = new reclaimer();
+#endif
+}
+
+static void stop_reclaimer() {
+#if defined(LEAN_MULTI_THREAD)
+    if (g_reclaimer)
+        g_reclaimer->stop();
+#endif
+}
+
+/* Continue freeing a graph with more than `LEAN_FREE_PAUSE_MIN_OBJS` objects, `todo` being its remaining objects. */
+static void lean_del_large(object * todo, bool mt) {
+    if (g_free_budget == 0) {
+        while (todo != nullptr) {
+            object * o = pop_back(todo);
+            lean_del_core(o, todo);
+        }
+        return;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+#if defined(LEAN_MULTI_THREAD)
+    if (mt && g_reclaimer && g_reclaimer->add(todo))
+        todo = nullptr;
+#else
+    (void)mt;
 #endif
+    if (todo != nullptr) {
+        if (!g_deferred_free_finalizer) {
+            g_deferred_free_finalizer = true;
+            register_thread_finalizer(finalize_deferred_free, nullptr);
+        }
+        /* prepend `todo` to `g_deferred_free` */
+        object * last = todo;
+        while (object * next = get_next(last))
+            last = next;
+        set_next(last, g_deferred_free);
+        g_deferred_free = todo;
+        free_deferred_slice(g_free_budget);
     }
+    record_free_pause(start);
+}
+
+/* Free `o`, whose reference counter has reached zero, and all objects only reachable from it. */
+static void lean_del(lean_object * o, bool mt) {
+#ifdef LEAN_LAZY_RC
+    (void)mt;
+    push_back(g_to_free, o);
+#else
+    object * todo = nullptr;
+    unsigned num_freed = 0;
+    while (true) {
+        lean_del_core(o, todo);
+        if (todo == nullptr)
+            break;
+        if (LEAN_UNLIKELY(++num_freed == LEAN_FREE_PAUSE_MIN_OBJS))
+            return lean_del_large(todo, mt);
+        o = pop_back(todo);
+    }
+    if (LEAN_UNLIKELY(g_deferred_free != nullptr)) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        free_deferred_slice(g_free_budget);
+        record_free_pause(start);
+    }
+#endif
+}
+
+/* Thread-local cache of pending decrements of multi-threaded reference counters, enabled by `LEAN_MT_RC_CACHE=1`.
+
+   This is a variant of biased reference counting that does not need any space in the object header for an owner
+   thread and a second counter: a decrement of a multi-threaded object `o` by a thread is only recorded in a small
+   direct-mapped table of that thread, and a later increment of `o` by the same thread consumes it, so that the
+   common pattern of a thread repeatedly taking and dropping a reference to a shared object, such as an
+   environment, does not need any atomic operations after the first one. Pending increments cannot be cached in
+   the same way, as the new reference may be passed to another thread. As the shared counter is never smaller
+   than the actual number of references, caching decrements only delays freeing objects. Pending decrements are
+   applied when their entry is evicted, every `LEAN_MT_RC_CACHE_FLUSH_INTERVAL` cached decrements, when a task
+   manager worker becomes idle, before a thread blocks waiting for a task or thunk or sleeps, and at thread exit.
+   Tasks and external objects are excluded, as freeing them has observable effects. Objects referencing them are
+   not, so the blocking paths must flush the cache: otherwise, e.g. a closure holding the last reference to a task
+   could delay its cancellation while the thread waits for another task. */
+#define LEAN_MT_RC_CACHE_SIZE           64
+#define LEAN_MT_RC_CACHE_FLUSH_INTERVAL 4096
+
+struct mt_rc_cache {
+    lean_object * m_objs[LEAN_MT_RC_CACHE_SIZE];
+    unsigned      m_pending[LEAN_MT_RC_CACHE_SIZE];
+    unsigned      m_num_decs{0};
+    mt_rc_cache() {
+        for (unsigned i = 0; i < LEAN_MT_RC_CACHE_SIZE; i++) {
+            m_objs[i]    = nullptr;
+            m_pending[i] = 0;
+        }
+    }
+};
+LEAN_THREAD_PTR(mt_rc_cache, g_mt_rc_cache);
+
+static inline unsigned mt_rc_cache_idx(lean_object * o) {
+    size_t h = reinterpret_cast<size_t>(o) >> 3;
+    return (h ^ (h >> 6)) % LEAN_MT_RC_CACHE_SIZE;
+}
+
+static void mt_rc_apply_decs(lean_object * o, unsigned n) {
+    /* The object may have been marked as persistent since the decrements were recorded, in which case its counter
+       is 0 and must not be modified anymore, as in `lean_dec_ref`. */
+    auto * rc = lean_get_rc_mt_addr(o);
+    int v = std::atomic_load_explicit(rc, std::memory_order_relaxed);
+    do {
+        if (v == 0)
+            return;
+    } while (!std::atomic_compare_exchange_weak_explicit(rc, &v, v + (int)n, std::memory_order_acq_rel,
+                                                         std::memory_order_relaxed));
+    if (v == -(int)n)
+        lean_del(o, true);
+}
+
+static void flush_mt_rc_cache() {
+    mt_rc_cache * c = g_mt_rc_cache;
+    if (!c)
+        return;
+    /* freeing objects may record further decrements, so repeat until the cache is empty */
+    bool applied;
+    do {
+        applied = false;
+        c->m_num_decs = 0;
+        for (unsigned i = 0; i < LEAN_MT_RC_CACHE_SIZE; i++) {
+            if (lean_object * o = c->m_objs[i]) {
+                /* clear the entry first, as freeing objects may reenter the cache */
+                unsigned n = c->m_pending[i];
+                c->m_objs[i] = nullptr;
+                c->m_pending[i] = 0;
+                mt_rc_apply_decs(o, n);
+                applied = true;
+            }
+        }
+    } while (applied);
+}
+
+static void finalize_mt_rc_cache(void * c) {
+    flush_mt_rc_cache();
+    delete static_cast<mt_rc_cache *>(c);
+    g_mt_rc_cache = nullptr;
+}
+
+/* Record a decrement of the multi-threaded object `o`. Returns `false` if it must be applied immediately. */
+static bool mt_rc_cache_dec(lean_object * o) {
+    uint8 tag = lean_ptr_tag(o);
+    if (tag == LeanTask || tag == LeanExternal)
+        return false;
+    mt_rc_cache * c = g_mt_rc_cache;
+    if (LEAN_UNLIKELY(!c)) {
+        c = g_mt_rc_cache = new mt_rc_cache();
+        register_thread_finalizer(finalize_mt_rc_cache, c);
+    }
+    unsigned i = mt_rc_cache_idx(o);
+    if (c->m_objs[i] == o) {
+        c->m_pending[i]++;
+    } else {
+        lean_object * old = c->m_objs[i];
+        unsigned n = c->m_pending[i];
+        c->m_objs[i] = o;
+        c->m_pending[i] = 1;
+        if (old)
+            mt_rc_apply_decs(old, n);
+    }
+    if (++c->m_num_decs >= LEAN_MT_RC_CACHE_FLUSH_INTERVAL)
+        flush_mt_rc_cache();
+    return true;
+}
+
+/* Consume `n` pending decrements of `o` instead of incrementing its counter if possible. */
+static bool mt_rc_cache_inc(lean_object * o, unsigned n) {
+    mt_rc_cache * c = g_mt_rc_cache;
+    if (!c)
+        return false;
+    unsigned i = mt_rc_cache_idx(o);
+    if (c->m_objs[i] != o || c->m_pending[i] < n)
+        return false;
+    c->m_pending[i] -= n;
+    if (c->m_pending[i] == 0)
+        c->m_objs[i] = nullptr;
+    return true;
+}
+
+extern "C" LEAN_EXPORT void lean_dec_ref_cold(lean_object * o) {
+    bool mt = o->m_rc != 1;
+    if (mt && LEAN_UNLIKELY(g_mt_rc_cache_enabled) && mt_rc_cache_dec(o))
+        return;
+    if (!mt || std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_acq_rel) == -1)
+        lean_del(o, mt);
+}
+
+void display_free_stats(std::ostream & out) {
+    if (g_free_budget == 0)
+        return;
+    out << "pauses freeing object graphs (> " << LEAN_FREE_PAUSE_MIN_OBJS << " objects, deferred in slices of "
+        << g_free_budget << "):\n";
+    display_log2_histogram(out, g_free_pauses, LEAN_NUM_FREE_PAUSE_BUCKETS, "us");
 }
 
 
@@ -366,6 +732,25 @@ extern "C" LEAN_EXPORT lean_obj_res lean_array_set_panic(lean_obj_arg a, lean_ob
 // =======================================
 // Thunks
 
+/* Threads forcing a thunk that is being evaluated by another thread park on one of these slots, selected by the
+   address of the thunk, until the value is published. */
+#define LEAN_THUNK_PARKING_SLOTS 64
+/* Number of times a thread forcing a thunk being evaluated yields before parking */
+#define LEAN_THUNK_SPIN_ITERS 16
+
+struct alignas(64) thunk_parking_slot {
+    mutex                 m_mutex;
+    condition_variable    m_cv;
+    std::atomic<unsigned> m_num_waiters{0};
+};
+
+static thunk_parking_slot g_thunk_parking_lot[LEAN_THUNK_PARKING_SLOTS];
+
+static thunk_parking_slot & get_thunk_parking_slot(b_obj_arg t) {
+    size_t h = reinterpret_cast<size_t>(t) >> 4;
+    return g_thunk_parking_lot[(h ^ (h >> 8)) % LEAN_THUNK_PARKING_SLOTS];
+}
+
 extern "C" LEAN_EXPORT b_obj_res lean_thunk_get_core(b_obj_arg t) {
     object * c = lean_to_thunk(t)->m_closure.exchange(nullptr);
     if (c != nullptr) {
@@ -381,14 +766,31 @@ extern "C" LEAN_EXPORT b_obj_res lean_thunk_get_core(b_obj_arg t) {
         lean_assert(lean_to_thunk(t)->m_value == nullptr);
         mark_mt(r);
         lean_to_thunk(t)->m_value = r;
+        /* The store above and the load of `m_num_waiters` below are sequentially consistent, so a waiter that we
+           do not see here will see the value before parking. */
+        thunk_parking_slot & slot = get_thunk_parking_slot(t);
+        if (slot.m_num_waiters.load() > 0) {
+            lock_guard<mutex> lock(slot.m_mutex);
+            slot.m_cv.notify_all();
+        }
         return r;
     } else {
         lean_assert(c == nullptr);
-        /* There is another thread executing the closure. We keep waiting for the m_value to be
-           set by another thread. */
-        while (!lean_to_thunk(t)->m_value) {
+        /* There is another thread executing the closure. We wait for the m_value to be set by
+           it, yielding for a short while before parking. */
+        for (unsigned i = 0; i < LEAN_THUNK_SPIN_ITERS; i++) {
+            if (object * r = lean_to_thunk(t)->m_value)
+                return r;
             this_thread::yield();
         }
+        flush_mt_rc_cache();
+        thunk_parking_slot & slot = get_thunk_parking_slot(t);
+        unique_lock<mutex> lock(slot.m_mutex);
+        slot.m_num_waiters++;
+        while (!lean_to_thunk(t)->m_value) {
+            slot.m_cv.wait(lock);
+        }
+        slot.m_num_waiters--;
         return lean_to_thunk(t)->m_value;
     }
 }
@@ -486,6 +888,244 @@ static obj_res mark_mt_fn(obj_arg o) {
     return lean_box(0);
 }
 
+/* Marking is incremental: an object is marked when it is pushed to the worklist, and only single-threaded objects
+   are pushed, so marking stops at multi-threaded and persistent subgraphs and each call takes time linear in the
+   number of newly marked objects and their fields. If `LEAN_MARK_MT_THREADS` is set to a number `n > 1`, the
+   marking of graphs with more than `LEAN_PARALLEL_MARK_MT_THRESHOLD` objects continues on the current thread and
+   `n - 1` helper threads created on first use. */
+#define LEAN_PARALLEL_MARK_MT_THRESHOLD 65536
+#define LEAN_PARALLEL_MARK_MT_BATCH     256
+#define LEAN_NUM_MARK_MT_BUCKETS        32
+
+static unsigned g_mark_mt_threads = 0;
+#ifdef LEAN_RUNTIME_STATS
+/* Remark: these counters are shared by all threads, so they are only maintained when compiled with
+   RUNTIME_STATS=ON to avoid contention on `lean_mark_mt`. */
+static std::atomic<uint64_t> g_num_mark_mt_objs(0);
+/* Number of `lean_mark_mt` calls by the binary logarithm of the number of objects marked by them */
+static std::atomic<uint64_t> g_mark_mt_calls[LEAN_NUM_MARK_MT_BUCKETS];
+#endif
+
+/* Apply `f` to the fields of `o` that must be marked together with it, except for the ones of external objects. */
+template<typename F> static inline void mark_mt_fields(object * o, F && f) {
+    uint8_t tag = lean_ptr_tag(o);
+    if (tag <= LeanMaxCtorTag) {
+        object ** it  = lean_ctor_obj_cptr(o);
+        object ** end = it + lean_ctor_num_objs(o);
+        for (; it != end; ++it) f(*it);
+    } else {
+        switch (tag) {
+        case LeanScalarArray:
+        case LeanString:
+        case LeanMPZ:
+        case LeanExternal:
+            break;
+        case LeanTask:
+            f(lean_task_get(o));
+            break;
+        case LeanClosure: {
+            object ** it  = lean_closure_arg_cptr(o);
+            object ** end = it + lean_closure_num_fixed(o);
+            for (; it != end; ++it) f(*it);
+            break;
+        }
+        case LeanArray: {
+            object ** it  = lean_array_cptr(o);
+            object ** end = it + lean_array_size(o);
+            for (; it != end; ++it) f(*it);
+            break;
+        }
+        case LeanThunk:
+            if (object * c = lean_to_thunk(o)->m_closure) f(c);
+            if (object * v = lean_to_thunk(o)->m_value) f(v);
+            break;
+        case LeanRef:
+            if (object * v = lean_to_ref(o)->m_value) f(v);
+            break;
+        default:
+            lean_unreachable();
+            break;
+        }
+    }
+}
+
+static void mark_mt_external(object * o) {
+    object * fn = lean_alloc_closure((void*)mark_mt_fn, 1, 0);
+    lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
+    lean_dec(fn);
+}
+
+#if defined(LEAN_MULTI_THREAD)
+/* Shared state of the threads marking a graph in parallel. The objects of the graph are only reachable by the
+   thread that called `lean_mark_mt`, which waits for the helpers to finish, but the helpers may race on marking
+   the same object, so they mark objects using compare-and-swap. */
+struct mark_mt_parallel_state {
+    mutex                  m_mutex;
+    condition_variable     m_cv;
+    /* marked objects whose fields still need to be visited */
+    std::vector<object *>  m_todo;
+    /* marked external objects, whose contents are marked after the parallel phase */
+    std::vector<object *>  m_externals;
+    unsigned               m_num_busy{0};
+    std::atomic<unsigned>  m_num_idle{0};
+    std::atomic<uint64_t>  m_num_marked{0};
+
+    void run() {
+        std::vector<object *> todo;
+        std::vector<object *> externals;
+        uint64_t num_marked = 0;
+        auto mark = [&](object * o) {
+            if (lean_is_scalar(o))
+                return;
+            int rc = std::atomic_load_explicit(lean_get_rc_mt_addr(o), std::memory_order_relaxed);
+            while (rc > 0) {
+                if (std::atomic_compare_exchange_weak_explicit(lean_get_rc_mt_addr(o), &rc, -rc,
+                                                               std::memory_order_relaxed, std::memory_order_relaxed)) {
+                    todo.push_back(o);
+                    return;
+                }
+            }
+        };
+        unique_lock<mutex> lock(m_mutex);
+        while (true) {
+            if (m_todo.empty()) {
+                if (m_num_busy == 0)
+                    break;
+                m_num_idle++;
+                m_cv.wait(lock);
+                m_num_idle--;
+                continue;
+            }
+            size_t n = std::min<size_t>(m_todo.size(), LEAN_PARALLEL_MARK_MT_BATCH);
+            todo.assign(m_todo.end() - n, m_todo.end());
+            m_todo.resize(m_todo.size() - n);
+            m_num_busy++;
+            lock.unlock();
+            while (!todo.empty()) {
+                object * o = todo.back();
+                todo.pop_back();
+                num_marked++;
+                if (lean_ptr_tag(o) == LeanExternal)
+                    externals.push_back(o);
+                else
+                    mark_mt_fields(o, mark);
+                if (todo.size() > 2*LEAN_PARALLEL_MARK_MT_BATCH && m_num_idle.load(std::memory_order_relaxed) > 0) {
+                    /* share half of our work with idle threads */
+                    lock_guard<mutex> _(m_mutex);
+                    size_t k = todo.size() / 2;
+                    m_todo.insert(m_todo.end(), todo.begin(), todo.begin() + k);
+                    todo.erase(todo.begin(), todo.begin() + k);
+                    m_cv.notify_all();
+                }
+            }
+            lock.lock();
+            m_num_busy--;
+            if (m_num_busy == 0 && m_todo.empty())
+                m_cv.notify_all();
+        }
+        m_externals.insert(m_externals.end(), externals.begin(), externals.end());
+        m_num_marked += num_marked;
+    }
+};
+
+/* Helper threads joining the marking of a single graph at a time. */
+class mark_mt_pool {
+    mutex                    m_mutex;
+    condition_variable       m_cv;
+    condition_variable       m_done_cv;
+    mark_mt_parallel_state * m_job{nullptr};
+    uint64_t                 m_job_id{0};
+    /* number of helpers that have not finished `m_job` yet */
+    unsigned                 m_num_running{0};
+    bool                     m_shutting_down{false};
+    std::atomic<bool>        m_busy{false};
+    std::vector<std::unique_ptr<lthread>> m_threads;
+
+    void run() {
+        save_stack_info(false);
+        if (trace_events_enabled()) set_trace_event_thread_name("mark_mt helper");
+        uint64_t last_job_id = 0;
+        unique_lock<mutex> lock(m_mutex);
+        while (true) {
+            m_cv.wait(lock, [&]() { return m_shutting_down || m_job_id != last_job_id; });
+            if (m_shutting_down)
+                break;
+            last_job_id = m_job_id;
+            mark_mt_parallel_state * s = m_job;
+            lock.unlock();
+            s->run();
+            lock.lock();
+            if (--m_num_running == 0)
+                m_done_cv.notify_all();
+        }
+    }
+
+public:
+    mark_mt_pool(unsigned num_threads) {
+        for (unsigned i = 0; i < num_threads; i++)
+            m_threads.emplace_back(new lthread([this]() { run(); }));
+    }
+
+    ~mark_mt_pool() {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_shutting_down = true;
+        }
+        m_cv.notify_all();
+        for (auto & t : m_threads)
+            t->join();
+    }
+
+    /* Run `s` on the current thread and all helpers. Returns `false` without doing anything if the helpers are
+       already busy with another graph. */
+    bool try_run(mark_mt_parallel_state & s) {
+        if (m_busy.exchange(true, std::memory_order_acquire))
+            return false;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_job = &s;
+            m_job_id++;
+            m_num_running = m_threads.size();
+        }
+        m_cv.notify_all();
+        s.run();
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_done_cv.wait(lock, [&]() { return m_num_running == 0; });
+            m_job = nullptr;
+        }
+        m_busy.store(false, std::memory_order_release);
+        return true;
+    }
+};
+
+/* Created on the first parallel marking and deleted in `finalize_object`. */
+static mark_mt_pool * g_mark_mt_pool = nullptr;
+static mutex *        g_mark_mt_pool_mutex = nullptr;
+
+static mark_mt_pool * get_mark_mt_pool() {
+    unique_lock<mutex> lock(*g_mark_mt_pool_mutex);
+    if (!g_mark_mt_pool)
+        g_mark_mt_pool = new mark_mt_pool(g_mark_mt_threads - 1);
+    return g_mark_mt_pool;
+}
+
+/* Finish marking the fields of the already marked objects `todo` in parallel. Returns the number of objects
+   marked, or 0 if `todo` has been left for the caller because the helpers are busy.
+   Remark: the caller must not hold any lock that the code run by `mark_mt_external` may try to take, such as
+   `task_manager::m_mutex`, since it waits for the helpers. */
+static uint64_t mark_mt_parallel(buffer<object *> & todo) {
+    mark_mt_parallel_state s;
+    s.m_todo.assign(todo.begin(), todo.end());
+    if (!get_mark_mt_pool()->try_run(s))
+        return 0;
+    todo.clear();
+    for (object * o : s.m_externals)
+        mark_mt_external(o);
+    return s.m_num_marked;
+}
+#endif
+
 extern "C" LEAN_EXPORT void lean_mark_mt(object * o) {
 #ifndef LEAN_MULTI_THREAD
     return;
@@ -493,58 +1133,41 @@ extern "C" LEAN_EXPORT void lean_mark_mt(object * o) {
     if (lean_is_scalar(o) || !lean_is_st(o)) return;
 
     buffer<object*> todo;
-    todo.push_back(o);
-    while (!todo.empty()) {
-        object * o = todo.back();
-        todo.pop_back();
+    auto mark = [&](object * o) {
         if (!lean_is_scalar(o) && lean_is_st(o)) {
             o->m_rc = -o->m_rc;
-            uint8_t tag = lean_ptr_tag(o);
-            if (tag <= LeanMaxCtorTag) {
-                object ** it  = lean_ctor_obj_cptr(o);
-                object ** end = it + lean_ctor_num_objs(o);
-                for (; it != end; ++it) todo.push_back(*it);
-            } else {
-                switch (tag) {
-                case LeanScalarArray:
-                case LeanString:
-                case LeanMPZ:
-                    break;
-                case LeanExternal: {
-                    object * fn = lean_alloc_closure((void*)mark_mt_fn, 1, 0);
-                    lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
-                    lean_dec(fn);
-                    break;
-                }
-                case LeanTask:
-                    todo.push_back(lean_task_get(o));
-                    break;
-                case LeanClosure: {
-                    object ** it  = lean_closure_arg_cptr(o);
-                    object ** end = it + lean_closure_num_fixed(o);
-                    for (; it != end; ++it) todo.push_back(*it);
-                    break;
-                }
-                case LeanArray: {
-                    object ** it  = lean_array_cptr(o);
-                    object ** end = it + lean_array_size(o);
-                    for (; it != end; ++it) todo.push_back(*it);
-                    break;
-                }
-                case LeanThunk:
-                    if (object * c = lean_to_thunk(o)->m_closure) todo.push_back(c);
-                    if (object * v = lean_to_thunk(o)->m_value) todo.push_back(v);
-                    break;
-                case LeanRef:
-                    if (object * v = lean_to_ref(o)->m_value) todo.push_back(v);
-                    break;
-                default:
-                    lean_unreachable();
-                    break;
-                }
-            }
+            todo.push_back(o);
         }
+    };
+    uint64_t num_marked = 0;
+    mark(o);
+    while (!todo.empty()) {
+        object * o = todo.back();
+        todo.pop_back();
+        num_marked++;
+        if (lean_ptr_tag(o) == LeanExternal)
+            mark_mt_external(o);
+        else
+            mark_mt_fields(o, mark);
+#if defined(LEAN_MULTI_THREAD)
+        if (LEAN_UNLIKELY(num_marked == LEAN_PARALLEL_MARK_MT_THRESHOLD) && g_mark_mt_threads > 1)
+            num_marked += mark_mt_parallel(todo);
+#endif
     }
+#ifdef LEAN_RUNTIME_STATS
+    g_num_mark_mt_objs.fetch_add(num_marked, std::memory_order_relaxed);
+    add_to_log2_histogram(g_mark_mt_calls, LEAN_NUM_MARK_MT_BUCKETS, num_marked);
+#endif
+}
+
+void display_mark_mt_stats(std::ostream & out) {
+#ifdef LEAN_RUNTIME_STATS
+    out << "objects marked multi-threaded:         " << g_num_mark_mt_objs << "\n";
+    out << "lean_mark_mt calls by objects marked:\n";
+    display_log2_histogram(out, g_mark_mt_calls, LEAN_NUM_MARK_MT_BUCKETS, "objs");
+#else
+    (void)out;
+#endif
 }
 
 // =======================================
@@ -557,6 +1180,7 @@ static lean_task_imp * alloc_task_imp(obj_arg c, unsigned prio, bool keep_alive)
     imp->m_closure     = c;
     imp->m_head_dep    = nullptr;
     imp->m_next_dep    = nullptr;
+    imp->m_head_waiter = nullptr;
     imp->m_prio        = prio;
     imp->m_canceled    = false;
     imp->m_keep_alive  = keep_alive;
@@ -565,10 +1189,102 @@ static lean_task_imp * alloc_task_imp(obj_arg c, unsigned prio, bool keep_alive)
 }
 
 static void free_task_imp(lean_task_imp * imp) {
+    lean_assert(imp->m_head_waiter == nullptr);
     lean_free_small_object((lean_object*)imp);
 }
 
+/* Trace data of an unfinished task, see `runtime/trace_event.h` */
+struct task_trace_info {
+    uint64_t              m_id{0};
+    double                m_created{0};
+    double                m_enqueued{0};
+    /* Tasks this task has been waiting on */
+    std::vector<uint64_t> m_deps;
+    /* Flow events to be ended when the task is run next */
+    std::vector<uint64_t> m_flows;
+};
+
+static mutex * g_task_trace_mutex = nullptr;
+static std::unordered_map<lean_task_object *, task_trace_info> * g_task_trace_infos = nullptr;
+
+static void trace_task_created(lean_task_object * t) {
+    double now = trace_event_now();
+    lock_guard<mutex> _(*g_task_trace_mutex);
+    task_trace_info & info = (*g_task_trace_infos)[t];
+    info.m_id      = mk_trace_event_id();
+    info.m_created = now;
+    if (g_current_task_object) {
+        // draw an arrow from the spawning task
+        uint64_t flow = mk_trace_event_id();
+        trace_event_flow_start(flow, now);
+        info.m_flows.push_back(flow);
+    }
+}
+
+static void trace_task_enqueued(lean_task_object * t) {
+    double now = trace_event_now();
+    lock_guard<mutex> _(*g_task_trace_mutex);
+    auto it = g_task_trace_infos->find(t);
+    if (it != g_task_trace_infos->end())
+        it->second.m_enqueued = now;
+}
+
+/* `t2` waits on `t1` */
+static void trace_task_dep(lean_task_object * t1, lean_task_object * t2) {
+    lock_guard<mutex> _(*g_task_trace_mutex);
+    auto it1 = g_task_trace_infos->find(t1);
+    auto it2 = g_task_trace_infos->find(t2);
+    if (it1 != g_task_trace_infos->end() && it2 != g_task_trace_infos->end())
+        it2->second.m_deps.push_back(it1->second.m_id);
+}
+
+/* `t` has been unblocked by the task finishing on the current thread */
+static void trace_task_unblocked(lean_task_object * t) {
+    uint64_t flow = mk_trace_event_id();
+    trace_event_flow_start(flow, trace_event_now());
+    lock_guard<mutex> _(*g_task_trace_mutex);
+    auto it = g_task_trace_infos->find(t);
+    if (it != g_task_trace_infos->end())
+        it->second.m_flows.push_back(flow);
+}
+
+static void trace_task_freed(lean_task_object * t) {
+    lock_guard<mutex> _(*g_task_trace_mutex);
+    g_task_trace_infos->erase(t);
+}
+
+/* Retrieve the trace data of `t` for `trace_task_run` before it is freed. */
+static task_trace_info trace_task_info(lean_task_object * t) {
+    lock_guard<mutex> _(*g_task_trace_mutex);
+    auto it = g_task_trace_infos->find(t);
+    if (it == g_task_trace_infos->end())
+        return task_trace_info();
+    task_trace_info info = it->second;
+    it->second.m_flows.clear();
+    return info;
+}
+
+/* Emit a slice for a single execution of a task's closure from `start` until now. */
+static void trace_task_run(task_trace_info const & info, unsigned prio, double start) {
+    if (info.m_id == 0)
+        return;
+    double end = trace_event_now();
+    for (uint64_t flow : info.m_flows)
+        trace_event_flow_end(flow, start);
+    std::string deps;
+    for (uint64_t dep : info.m_deps) {
+        if (!deps.empty()) deps += ",";
+        deps += std::to_string(dep);
+    }
+    char args[256];
+    snprintf(args, sizeof(args), "\"id\":%llu,\"prio\":%u,\"spawned_us\":%.3f,\"queue_wait_us\":%.3f",
+             static_cast<unsigned long long>(info.m_id), prio, info.m_created,
+             info.m_enqueued > 0 ? start - info.m_enqueued : 0.0);
+    trace_event_complete("task", "task", start, end - start, std::string(args) + ",\"deps\":[" + deps + "]");
+}
+
 static void free_task(lean_task_object * t) {
+    if (trace_events_enabled()) trace_task_freed(t);
     if (t->m_imp) free_task_imp(t->m_imp);
     lean_free_small_object((lean_object*)t);
 }
@@ -577,47 +1293,194 @@ struct scoped_current_task_object : flet<lean_task_object *> {
     scoped_current_task_object(lean_task_object * t):flet(g_current_task_object, t) {}
 };
 
+/* Thread blocked in `task_manager::wait_for/wait_any`. */
+struct task_waiter {
+    condition_variable m_cv;
+    /* First awaited task that has been finished */
+    lean_task_object * m_result{nullptr};
+};
+
+}
+
+/* Registration of a `task_waiter` in the waiter list of a single task, so that finishing a task only wakes up
+   the threads waiting on it. Declared in `lean.h`, thus not part of the `lean` namespace. */
+struct lean_task_waiter {
+    lean::task_waiter * m_waiter;
+    /* `nullptr` after the task has been finished and the registration removed from its list */
+    lean_task_object *  m_task{nullptr};
+    lean_task_waiter *  m_prev{nullptr};
+    lean_task_waiter *  m_next{nullptr};
+};
+
+namespace lean {
+
+/* Bounded run queue of a single worker thread, in the style of Go's per-processor run queues.
+   Only the owning worker pushes (at `m_tail`), while the owner and other (stealing) workers pop
+   at `m_head` using a CAS. Thus both operations are lock-free and tasks of the same priority are
+   still dequeued in FIFO order. */
+#define LEAN_RUN_QUEUE_SIZE 256
+
+struct run_queue {
+    std::atomic<unsigned>           m_head{0};
+    std::atomic<unsigned>           m_tail{0};
+    std::atomic<lean_task_object *> m_tasks[LEAN_RUN_QUEUE_SIZE]{};
+
+    /* Must only be called by the owner. Returns `false` if the queue is full. */
+    bool push(lean_task_object * t) {
+        unsigned head = m_head.load(std::memory_order_acquire);
+        unsigned tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - head >= LEAN_RUN_QUEUE_SIZE)
+            return false;
+        m_tasks[tail % LEAN_RUN_QUEUE_SIZE].store(t, std::memory_order_relaxed);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    lean_task_object * pop() {
+        unsigned head = m_head.load(std::memory_order_acquire);
+        while (true) {
+            unsigned tail = m_tail.load(std::memory_order_acquire);
+            if (head == tail)
+                return nullptr;
+            lean_task_object * t = m_tasks[head % LEAN_RUN_QUEUE_SIZE].load(std::memory_order_relaxed);
+            if (m_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel))
+                return t;
+        }
+    }
+};
+
+struct task_worker {
+    run_queue m_queues[LEAN_MAX_PRIO+1];
+    unsigned  m_idx{0};
+    unsigned  m_tick{0};
+};
+
+/* Worker of the current thread, if it is a standard worker of the task manager. */
+LEAN_THREAD_PTR(task_worker, g_current_worker);
+
+/* Time after which an idle dedicated worker exits */
+#define LEAN_DEDICATED_WORKER_IDLE_MS 10000
+
+/* Statistics of dedicated workers, see `display_task_stats` */
+static std::atomic<uint64_t> g_num_dedicated_tasks(0);
+static std::atomic<uint64_t> g_num_dedicated_threads(0);
+static std::atomic<unsigned> g_max_dedicated_workers(0);
+
+/* Number of idle dedicated workers kept for reuse, see `task_manager::spawn_dedicated_worker` */
+static unsigned get_max_idle_dedicated_workers(unsigned num_workers) {
+#ifndef LEAN_EMSCRIPTEN
+    if (char const * num_threads = std::getenv("LEAN_MAX_IDLE_DEDICATED_THREADS")) {
+        return atoi(num_threads);
+    }
+#endif
+    return num_workers;
+}
+
 class task_manager {
+    /* Protects the task dependency graph and state transitions of `lean_task_imp`s */
     mutex                                         m_mutex;
+    /* Protects the shared queues and the set of standard workers */
+    mutex                                         m_queue_mutex;
     std::vector<std::unique_ptr<lthread>>         m_std_workers;
-    unsigned                                      m_idle_std_workers{0};
+    std::unique_ptr<task_worker[]>                m_workers;
+    std::atomic<unsigned>                         m_num_std_workers{0};
+    std::atomic<unsigned>                         m_idle_std_workers{0};
     unsigned                                      m_max_std_workers{0};
-    unsigned                                      m_num_dedicated_workers{0};
+    /* Tasks of dedicated priority are run by a separate, elastic pool of workers, as they may block for an
+       arbitrarily long time on I/O and must not occupy the standard workers. A new dedicated worker is spawned for
+       each such task unless there is an idle one, and idle dedicated workers are kept for reuse for
+       `LEAN_DEDICATED_WORKER_IDLE_MS`, up to `m_max_idle_dedicated_workers` of them. These fields are protected by
+       `m_queue_mutex`. */
+    std::deque<lean_task_object *>                m_dedicated_queue;
+    std::atomic<unsigned>                         m_num_dedicated_workers{0};
+    /* Idle dedicated workers that have not been claimed by `enqueue_dedicated` yet */
+    unsigned                                      m_idle_dedicated_workers{0};
+    unsigned                                      m_max_idle_dedicated_workers{0};
+    /* Number of idle dedicated workers claimed by `enqueue_dedicated` but not woken up yet */
+    unsigned                                      m_dedicated_wakeups{0};
+    /* Number of dedicated workers that are not running the closure of a task, i.e. that are idle, claimed, or
+       about to pick up or finish a task. Only decremented with `m_queue_mutex` held. */
+    std::atomic<unsigned>                         m_dedicated_outside_tasks{0};
+    condition_variable                            m_dedicated_cv;
+    condition_variable                            m_dedicated_exit_cv;
+    /* Tasks enqueued from outside of a standard worker or overflowing its run queue */
     std::deque<lean_task_object *>                m_queues[LEAN_MAX_PRIO+1];
-    unsigned                                      m_queues_size{0};
-    unsigned                                      m_max_prio{0};
+    /* Number of queued tasks per priority over all queues */
+    std::atomic<unsigned>                         m_queued[LEAN_MAX_PRIO+1]{};
+    std::atomic<unsigned>                         m_queues_size{0};
     condition_variable                            m_queue_cv;
-    condition_variable                            m_task_finished_cv;
     bool                                          m_shutting_down{false};
 
-    lean_task_object * dequeue() {
-        lean_assert(m_queues_size != 0);
-        std::deque<lean_task_object *> & q = m_queues[m_max_prio];
-        lean_assert(!q.empty());
-        lean_task_object * result      = q.front();
+    lean_task_object * dequeue_shared(unsigned prio) {
+        unique_lock<mutex> lock(m_queue_mutex);
+        std::deque<lean_task_object *> & q = m_queues[prio];
+        if (q.empty())
+            return nullptr;
+        lean_task_object * result = q.front();
         q.pop_front();
-        m_queues_size--;
-        if (q.empty()) {
-            while (m_max_prio > 0) {
-                --m_max_prio;
-                if (!m_queues[m_max_prio].empty())
-                    break;
+        return result;
+    }
+
+    lean_task_object * steal(task_worker * w, unsigned prio) {
+        unsigned n = m_num_std_workers;
+        for (unsigned i = 1; i < n; i++) {
+            if (lean_task_object * t = m_workers[(w->m_idx + i) % n].m_queues[prio].pop())
+                return t;
+        }
+        return nullptr;
+    }
+
+    lean_task_object * dequeue(task_worker * w) {
+        if (m_queues_size == 0)
+            return nullptr;
+        /* Like Go's scheduler, occasionally check the shared queues first so that tasks enqueued from
+           outside of the workers cannot be starved by workers that keep feeding their own queues. */
+        bool shared_first = ++w->m_tick % 61 == 0;
+        unsigned prio = LEAN_MAX_PRIO + 1;
+        while (prio > 0) {
+            --prio;
+            if (m_queued[prio] == 0)
+                continue;
+            lean_task_object * t = shared_first ? dequeue_shared(prio) : nullptr;
+            if (!t) t = w->m_queues[prio].pop();
+            if (!t && !shared_first) t = dequeue_shared(prio);
+            if (!t) t = steal(w, prio);
+            if (t) {
+                m_queued[prio]--;
+                m_queues_size--;
+                return t;
             }
         }
-        return result;
+        return nullptr;
     }
 
     void enqueue_core(lean_task_object * t) {
         lean_assert(t->m_imp);
+        if (trace_events_enabled()) trace_task_enqueued(t);
         unsigned prio = t->m_imp->m_prio;
         if (prio > LEAN_MAX_PRIO) {
-            spawn_dedicated_worker(t);
+            enqueue_dedicated(t);
             return;
         }
-        if (prio > m_max_prio)
-            m_max_prio = prio;
-        m_queues[prio].push_back(t);
+        /* Count the task before publishing it, as otherwise a concurrent `dequeue` could take it and decrement the
+           counters first, making them wrap around. */
+        m_queued[prio]++;
         m_queues_size++;
+        task_worker * w = g_current_worker;
+        if (w && w->m_queues[prio].push(t)) {
+            if (m_idle_std_workers == 0 && m_num_std_workers >= m_max_std_workers)
+                return;
+            unique_lock<mutex> lock(m_queue_mutex);
+            notify_worker();
+        } else {
+            unique_lock<mutex> lock(m_queue_mutex);
+            m_queues[prio].push_back(t);
+            notify_worker();
+        }
+    }
+
+    /* Wake up an idle worker or spawn a new one if none is available. Must be called with `m_queue_mutex` held. */
+    void notify_worker() {
         if (!m_idle_std_workers && m_std_workers.size() < m_max_std_workers)
             spawn_worker();
         else
@@ -642,58 +1505,145 @@ class task_manager {
         lock.lock();
     }
 
+    /* Must be called with `m_queue_mutex` held. */
     void spawn_worker() {
         if (m_shutting_down)
             return;
 
-        m_std_workers.emplace_back(new lthread([this]() {
+        task_worker * w = &m_workers[m_std_workers.size()];
+        w->m_idx = m_std_workers.size();
+        m_num_std_workers++;
+        m_std_workers.emplace_back(new lthread([this, w]() {
             save_stack_info(false);
-            unique_lock<mutex> lock(m_mutex);
-            m_idle_std_workers++;
+            g_current_worker = w;
+            pin_current_thread(w->m_idx);
+            if (trace_events_enabled()) set_trace_event_thread_name("task worker " + std::to_string(w->m_idx));
             while (true) {
+                if (lean_task_object * t = dequeue(w)) {
+                    run_task(t);
+                    reset_heartbeat();
+                    continue;
+                }
+                /* While idle, apply cached and deferred frees, and periodically return memory of empty
+                   allocator pages to the OS */
+                flush_mt_rc_cache();
+                free_deferred_slice(SIZE_MAX);
+                bool release_pending = release_empty_pages();
+                unique_lock<mutex> lock(m_queue_mutex);
                 if (m_queues_size == 0) {
-                    if (m_shutting_down) {
+                    if (m_shutting_down)
                         break;
+                    /* `enqueue_core` increments `m_queues_size` before checking `m_idle_std_workers`,
+                       so we must check `m_queues_size` again after announcing that we are idle. */
+                    m_idle_std_workers++;
+                    if (m_queues_size == 0) {
+                        if (release_pending)
+                            m_queue_cv.wait_for(lock, chrono::milliseconds(get_page_decommit_delay()));
+                        else
+                            m_queue_cv.wait(lock);
                     }
-                    m_queue_cv.wait(lock);
-                    continue;
+                    m_idle_std_workers--;
                 }
-
-                lean_task_object * t = dequeue();
-                m_idle_std_workers--;
-                run_task(lock, t);
-                m_idle_std_workers++;
-                reset_heartbeat();
             }
-            m_idle_std_workers--;
+            g_current_worker = nullptr;
         }));
     }
 
-    void spawn_dedicated_worker(lean_task_object * t) {
-        m_num_dedicated_workers++;
-        lthread([this, t]() {
+    void enqueue_dedicated(lean_task_object * t) {
+        g_num_dedicated_tasks.fetch_add(1, std::memory_order_relaxed);
+        {
+            unique_lock<mutex> lock(m_queue_mutex);
+            m_dedicated_queue.push_back(t);
+            if (m_idle_dedicated_workers > 0) {
+                /* Claim an idle worker so that concurrent calls cannot wake up the same one for different tasks */
+                m_idle_dedicated_workers--;
+                m_dedicated_wakeups++;
+                m_dedicated_cv.notify_one();
+                return;
+            }
+            reserve_dedicated_worker();
+        }
+        /* Create the thread outside of `m_queue_mutex`, which is also taken by idle standard workers */
+        spawn_dedicated_worker();
+    }
+
+    /* Account for a new dedicated worker, which must then be started using `spawn_dedicated_worker`.
+       Must be called with `m_queue_mutex` held. */
+    void reserve_dedicated_worker() {
+        unsigned n = ++m_num_dedicated_workers;
+        m_dedicated_outside_tasks++;
+        unsigned max = g_max_dedicated_workers.load(std::memory_order_relaxed);
+        while (n > max && !g_max_dedicated_workers.compare_exchange_weak(max, n, std::memory_order_relaxed)) {}
+    }
+
+    void spawn_dedicated_worker() {
+        g_num_dedicated_threads.fetch_add(1, std::memory_order_relaxed);
+        lthread([this]() {
             save_stack_info(false);
-            unique_lock<mutex> lock(m_mutex);
-            run_task(lock, t);
+            if (trace_events_enabled()) set_trace_event_thread_name("dedicated task worker");
+            unique_lock<mutex> lock(m_queue_mutex);
+            while (true) {
+                /* Queued tasks are run even when shutting down, as standard workers draining their queues may still
+                   spawn and wait for dedicated tasks. */
+                if (!m_dedicated_queue.empty()) {
+                    /* This may be a task for which another, claimed worker has been woken up; that worker will
+                       find the queue empty and become idle again. */
+                    lean_task_object * t = m_dedicated_queue.front();
+                    m_dedicated_queue.pop_front();
+                    m_dedicated_outside_tasks--;
+                    lock.unlock();
+                    run_task(t, /* dedicated */ true);
+                    reset_heartbeat();
+                    flush_mt_rc_cache();
+                    free_deferred_slice(SIZE_MAX);
+                    lock.lock();
+                    continue;
+                }
+                if (m_shutting_down || m_idle_dedicated_workers >= m_max_idle_dedicated_workers)
+                    break;
+                m_idle_dedicated_workers++;
+                m_dedicated_cv.wait_for(lock, chrono::milliseconds(LEAN_DEDICATED_WORKER_IDLE_MS),
+                                        [&]() { return m_dedicated_wakeups > 0 || m_shutting_down; });
+                if (m_dedicated_wakeups > 0) {
+                    // claimed by `enqueue_dedicated`, which already decremented `m_idle_dedicated_workers`
+                    m_dedicated_wakeups--;
+                    continue;
+                }
+                // timed out or shutting down
+                m_idle_dedicated_workers--;
+                break;
+            }
             m_num_dedicated_workers--;
+            m_dedicated_outside_tasks--;
+            if (m_shutting_down)
+                m_dedicated_exit_cv.notify_all();
         });
         // `lthread` will be implicitly freed, which frees up its control resources but does not terminate the thread
     }
 
-    void run_task(unique_lock<mutex> & lock, lean_task_object * t) {
+    /* If `dedicated` is true, `m_dedicated_outside_tasks` is incremented again as soon as the closure of `t` has
+       returned, before its result is published. */
+    void run_task(lean_task_object * t, bool dedicated = false) {
+        unique_lock<mutex> lock(m_mutex);
         lean_assert(t->m_imp);
         if (t->m_imp->m_deleted) {
+            if (dedicated) m_dedicated_outside_tasks++;
+            lock.unlock();
             free_task(t);
             return;
         }
         reset_heartbeat();
         object * v = nullptr;
+        unsigned prio = t->m_imp->m_prio;
+        double start = trace_events_enabled() ? trace_event_now() : 0;
         {
             scoped_current_task_object scope_cur_task(t);
             object * c = t->m_imp->m_closure;
             t->m_imp->m_closure = nullptr;
             lock.unlock();
             v = lean_apply_1(c, box(0));
+            if (v != nullptr) mark_mt(v);
+            if (dedicated) m_dedicated_outside_tasks++;
             // If deactivation was delayed by `m_keep_alive`, deactivate after the final execution (`v != nulltpr`)
             if (v != nullptr && t->m_imp->m_keep_alive) {
                 lean_dec_ref((lean_object*)t);
@@ -705,10 +1655,16 @@ class task_manager {
             lock.unlock();
             if (v) lean_dec(v);
             free_task(t);
-            lock.lock();
         } else if (v != nullptr) {
             lean_assert(t->m_imp->m_closure == nullptr);
-            resolve_core(t, v);
+            if (trace_events_enabled()) {
+                // the slice should enclose the dependency arrows started by `handle_finished`
+                task_trace_info info = trace_task_info(t);
+                resolve_core(t, v);
+                trace_task_run(info, prio, start);
+            } else {
+                resolve_core(t, v);
+            }
         } else {
             // `bind` task has not finished yet, re-add as dependency of nested task
             // NOTE: closure MUST be extracted before unlocking the mutex as otherwise
@@ -716,20 +1672,60 @@ class task_manager {
             // between.
             object * c = t->m_imp->m_closure;
             lock.unlock();
+            if (trace_events_enabled()) trace_task_run(trace_task_info(t), prio, start);
             add_dep(lean_to_task(closure_arg_cptr(c)[0]), t);
-            lock.lock();
         }
     }
 
+    /* `v` must already have been marked multi-threaded before taking `m_mutex`, see `mark_mt_parallel`. */
     void resolve_core(lean_task_object * t, object * v) {
         handle_finished(t);
-        mark_mt(v);
         t->m_value = v;
         /* After the task has been finished and we propagated
            dependencies, we can release `m_imp` and keep just the value */
+        wake_waiters(t);
         free_task_imp(t->m_imp);
         t->m_imp   = nullptr;
-        m_task_finished_cv.notify_all();
+        if (trace_events_enabled()) trace_task_freed(t);
+    }
+
+    /* Must be called with `m_mutex` held. */
+    void add_waiter(lean_task_object * t, lean_task_waiter & n) {
+        lean_assert(t->m_imp);
+        n.m_task = t;
+        n.m_prev = nullptr;
+        n.m_next = t->m_imp->m_head_waiter;
+        if (n.m_next)
+            n.m_next->m_prev = &n;
+        t->m_imp->m_head_waiter = &n;
+    }
+
+    /* Must be called with `m_mutex` held. */
+    void remove_waiter(lean_task_waiter & n) {
+        if (!n.m_task)
+            return;
+        if (n.m_prev)
+            n.m_prev->m_next = n.m_next;
+        else
+            n.m_task->m_imp->m_head_waiter = n.m_next;
+        if (n.m_next)
+            n.m_next->m_prev = n.m_prev;
+        n.m_task = nullptr;
+    }
+
+    void wake_waiters(lean_task_object * t) {
+        lean_task_waiter * it = t->m_imp->m_head_waiter;
+        t->m_imp->m_head_waiter = nullptr;
+        while (it) {
+            lean_task_waiter * next_it = it->m_next;
+            it->m_task = nullptr;
+            task_waiter * w = it->m_waiter;
+            if (!w->m_result) {
+                w->m_result = t;
+                w->m_cv.notify_one();
+            }
+            it = next_it;
+        }
     }
 
     void handle_finished(lean_task_object * t) {
@@ -743,6 +1739,7 @@ class task_manager {
             if (it->m_imp->m_deleted) {
                 free_task(it);
             } else {
+                if (trace_events_enabled()) trace_task_unblocked(it);
                 enqueue_core(it);
             }
             it = next_it;
@@ -762,30 +1759,38 @@ class task_manager {
 
 public:
     task_manager(unsigned max_std_workers):
-        m_max_std_workers(max_std_workers) {
+        m_workers(new task_worker[max_std_workers]), m_max_std_workers(max_std_workers),
+        m_max_idle_dedicated_workers(get_max_idle_dedicated_workers(max_std_workers)) {
     }
 
     ~task_manager() {
         {
-            unique_lock<mutex> lock(m_mutex);
+            unique_lock<mutex> lock(m_queue_mutex);
             m_shutting_down = true;
             // we can assume that `m_std_workers` will not be changed after this line
         }
         m_queue_cv.notify_all();
+        m_dedicated_cv.notify_all();
 #ifndef LEAN_EMSCRIPTEN
         // wait for all workers to finish
         for (auto & t : m_std_workers)
             t->join();
         // never seems to terminate under Emscripten
 #endif
+        /* Dedicated workers outside of a task reference the task manager, so wait for them to exit. This includes
+           idle workers claimed by `enqueue_dedicated` that have not woken up yet, and workers that have just
+           finished a task. Such workers first drain `m_dedicated_queue`. As before, dedicated workers that are still
+           running the closure of a task are not waited for. */
+        unique_lock<mutex> lock(m_queue_mutex);
+        m_dedicated_exit_cv.wait(lock, [&]() { return m_dedicated_outside_tasks == 0; });
     }
 
     void enqueue(lean_task_object * t) {
-        unique_lock<mutex> lock(m_mutex);
         enqueue_core(t);
     }
 
     void resolve(lean_task_object * t, object * v) {
+        mark_mt(v);
         unique_lock<mutex> lock(m_mutex);
         if (t->m_value) {
             lock.unlock(); // `dec(v)` could lead to `deactivate_task` trying to take the lock
@@ -797,13 +1802,15 @@ public:
 
     void add_dep(lean_task_object * t1, lean_task_object * t2) {
         lean_assert(t2->m_value == nullptr);
+        if (trace_events_enabled()) trace_task_dep(t1, t2);
         if (t1->m_value) {
-            enqueue(t2);
+            enqueue_core(t2);
             return;
         }
         unique_lock<mutex> lock(m_mutex);
         lean_assert(t2->m_value == nullptr);
         if (t1->m_value) {
+            lock.unlock();
             enqueue_core(t2);
             return;
         }
@@ -814,21 +1821,37 @@ public:
     void wait_for(lean_task_object * t) {
         if (t->m_value)
             return;
+        /* Before taking `m_mutex`, as freeing objects may deactivate tasks */
+        flush_mt_rc_cache();
         unique_lock<mutex> lock(m_mutex);
         if (t->m_value)
             return;
-        m_task_finished_cv.wait(lock, [&]() { return t->m_value != nullptr; });
+        task_waiter w;
+        lean_task_waiter n;
+        n.m_waiter = &w;
+        add_waiter(t, n);
+        w.m_cv.wait(lock, [&]() { return w.m_result != nullptr; });
     }
 
     object * wait_any(object * task_list) {
         if (object * t = wait_any_check(task_list))
             return t;
+        flush_mt_rc_cache();
         unique_lock<mutex> lock(m_mutex);
-        while (true) {
-            if (object * t = wait_any_check(task_list))
-                return t;
-            m_task_finished_cv.wait(lock);
-        }
+        if (object * t = wait_any_check(task_list))
+            return t;
+        /* None of the tasks can be finished while we hold the lock, so register on all of them */
+        task_waiter w;
+        std::vector<lean_task_waiter> ns;
+        for (object * it = task_list; !is_scalar(it); it = cnstr_get(it, 1))
+            ns.push_back(lean_task_waiter{&w});
+        size_t i = 0;
+        for (object * it = task_list; !is_scalar(it); it = cnstr_get(it, 1))
+            add_waiter(lean_to_task(lean_ctor_get(it, 0)), ns[i++]);
+        w.m_cv.wait(lock, [&]() { return w.m_result != nullptr; });
+        for (lean_task_waiter & n : ns)
+            remove_waiter(n);
+        return (object *)w.m_result;
     }
 
     void deactivate_task(lean_task_object * t) {
@@ -858,10 +1881,96 @@ public:
 
 static task_manager * g_task_manager = nullptr;
 
+void display_task_stats(std::ostream & out) {
+    uint64_t num_tasks   = g_num_dedicated_tasks;
+    uint64_t num_threads = g_num_dedicated_threads;
+    out << "dedicated task runs:                   " << num_tasks << "\n";
+    out << "dedicated worker threads spawned:      " << num_threads << "\n";
+    out << "dedicated task runs by reused workers: " << (num_tasks > num_threads ? num_tasks - num_threads : 0) << "\n";
+    out << "max concurrent dedicated workers:      " << g_max_dedicated_workers << "\n";
+}
+
+#if defined(LEAN_MULTI_THREAD)
+/* Resolves promises after a timeout. All timers are served by a single thread waiting for the earliest
+   deadline in a binary heap, so pending timers do not occupy any task manager workers. */
+class timer_manager {
+    typedef chrono::steady_clock::time_point time_point;
+    typedef std::pair<time_point, lean_task_object *> timer;
+    struct later {
+        bool operator()(timer const & t1, timer const & t2) const { return t1.first > t2.first; }
+    };
+
+    mutex                                              m_mutex;
+    condition_variable                                 m_cv;
+    std::priority_queue<timer, std::vector<timer>, later> m_timers;
+    std::unique_ptr<lthread>                           m_thread;
+    bool                                               m_shutting_down{false};
+
+    void run() {
+        save_stack_info(false);
+        unique_lock<mutex> lock(m_mutex);
+        while (!m_shutting_down) {
+            if (m_timers.empty()) {
+                m_cv.wait(lock);
+            } else if (m_timers.top().first <= chrono::steady_clock::now()) {
+                lean_task_object * promise = m_timers.top().second;
+                m_timers.pop();
+                lock.unlock();
+                g_task_manager->resolve(promise, box(0));
+                lean_dec_ref((lean_object *)promise);
+                lock.lock();
+            } else {
+                m_cv.wait_until(lock, m_timers.top().first);
+            }
+        }
+    }
+
+public:
+    ~timer_manager() {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_shutting_down = true;
+        }
+        m_cv.notify_one();
+        if (m_thread)
+            m_thread->join();
+        // never resolved, but we must still release them
+        while (!m_timers.empty()) {
+            lean_dec_ref((lean_object *)m_timers.top().second);
+            m_timers.pop();
+        }
+    }
+
+    /* Resolve `promise` (consumed) with `()` after `ms` milliseconds. */
+    void add(uint32 ms, lean_task_object * promise) {
+        unique_lock<mutex> lock(m_mutex);
+        if (!m_thread)
+            m_thread.reset(new lthread([this]() { run(); }));
+        time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(ms);
+        bool earliest = m_timers.empty() || deadline < m_timers.top().first;
+        m_timers.push(timer(deadline, promise));
+        if (earliest)
+            m_cv.notify_one();
+    }
+};
+
+static timer_manager * g_timer_manager = nullptr;
+static mutex * g_timer_manager_mutex = nullptr;
+#endif
+
+/* Must be called before the task manager is finalized. */
+static void finalize_timer_manager() {
+#if defined(LEAN_MULTI_THREAD)
+    delete g_timer_manager;
+    g_timer_manager = nullptr;
+#endif
+}
+
 extern "C" LEAN_EXPORT void lean_init_task_manager_using(unsigned num_workers) {
     lean_assert(g_task_manager == nullptr);
 #if defined(LEAN_MULTI_THREAD)
     if (num_workers > 0) {
+        init_reclaimer();
         g_task_manager = new task_manager(num_workers);
     }
 #endif
@@ -882,6 +1991,8 @@ extern "C" LEAN_EXPORT void lean_init_task_manager() {
 
 extern "C" LEAN_EXPORT void lean_finalize_task_manager() {
     if (g_task_manager) {
+        finalize_timer_manager();
+        stop_reclaimer();
         delete g_task_manager;
         g_task_manager = nullptr;
     }
@@ -891,6 +2002,7 @@ scoped_task_manager::scoped_task_manager(unsigned num_workers) {
     lean_assert(g_task_manager == nullptr);
 #if defined(LEAN_MULTI_THREAD)
     if (num_workers > 0) {
+        init_reclaimer();
         g_task_manager = new task_manager(num_workers);
     }
 #endif
@@ -898,6 +2010,8 @@ scoped_task_manager::scoped_task_manager(unsigned num_workers) {
 
 scoped_task_manager::~scoped_task_manager() {
     if (g_task_manager) {
+        finalize_timer_manager();
+        stop_reclaimer();
         delete g_task_manager;
         g_task_manager = nullptr;
     }
@@ -928,6 +2042,7 @@ static lean_task_object * alloc_task(obj_arg c, unsigned prio, bool keep_alive)
     o->m_imp   = alloc_task_imp(c, prio, keep_alive);
     if (keep_alive)
         lean_inc_ref((lean_object*)o);
+    if (trace_events_enabled()) trace_task_created(o);
     return o;
 }
 
@@ -1016,6 +2131,84 @@ extern "C" LEAN_EXPORT obj_res lean_task_bind_core(obj_arg x, obj_arg f, unsigne
     }
 }
 
+/* `Task.mapList` is implemented by a single task that waits for the given tasks in order. Whenever it is woken up,
+   it skips all tasks that have finished in the meantime and registers itself as a dependency of the next unfinished
+   one, so the total work is linear in the number of tasks even if they finish in any order. The closure of the
+   task is `task_map_list_fn(waiting, f, tasks, idx)` where `waiting` is the task it is currently registered on,
+   which must be the first closure argument (see `run_task`). */
+/* Returns the list of the values of the array of tasks `tasks`, waiting for them if necessary. */
+static obj_res task_values_to_list(b_obj_arg tasks) {
+    object * vs = lean_box(0);
+    for (size_t i = lean_array_size(tasks); i > 0; i--) {
+        object * v = lean_task_get(lean_array_get_core(tasks, i - 1));
+        inc(v);
+        object * c = alloc_cnstr(1, 2, 0);
+        cnstr_set(c, 0, v);
+        cnstr_set(c, 1, vs);
+        vs = c;
+    }
+    return vs;
+}
+
+static obj_res task_map_list_fn(obj_arg waiting, obj_arg f, obj_arg tasks, obj_arg idx, obj_arg) {
+    lean_dec(waiting);
+    size_t i = lean_unbox(idx);
+    size_t n = lean_array_size(tasks);
+    while (i < n && lean_to_task(lean_array_get_core(tasks, i))->m_value)
+        i++;
+    if (i < n) {
+        object * t = lean_array_get_core(tasks, i);
+        lean_inc(t);
+        object * c = lean_alloc_closure((void*)task_map_list_fn, 5, 4);
+        lean_closure_set(c, 0, t);
+        lean_closure_set(c, 1, f);
+        lean_closure_set(c, 2, tasks);
+        lean_closure_set(c, 3, lean_box(i));
+        mark_mt(c);
+        lean_assert(g_current_task_object->m_imp->m_closure == nullptr);
+        g_current_task_object->m_imp->m_closure = c;
+        return nullptr; /* notify queue that task did not finish yet. */
+    }
+    object * vs = task_values_to_list(tasks);
+    lean_dec(tasks);
+    return lean_apply_1(f, vs);
+}
+
+extern "C" LEAN_EXPORT obj_res lean_task_map_list_core(obj_arg f, obj_arg tasks, unsigned prio,
+      bool sync, bool keep_alive) {
+    size_t n = 0;
+    for (object * it = tasks; !lean_is_scalar(it); it = lean_ctor_get(it, 1))
+        n++;
+    object * ts = lean_alloc_array(n, n);
+    size_t i = 0;
+    for (object * it = tasks; !lean_is_scalar(it); it = lean_ctor_get(it, 1)) {
+        lean_inc(lean_ctor_get(it, 0));
+        lean_array_set_core(ts, i++, lean_ctor_get(it, 0));
+    }
+    lean_dec(tasks);
+    i = 0;
+    while (i < n && lean_to_task(lean_array_get_core(ts, i))->m_value)
+        i++;
+    if (!g_task_manager || (sync && i == n)) {
+        object * vs = task_values_to_list(ts);
+        lean_dec(ts);
+        return lean_task_pure(apply_1(f, vs));
+    }
+    object * waiting = i < n ? lean_array_get_core(ts, i) : lean_box(0);
+    lean_inc(waiting);
+    object * c = lean_alloc_closure((void*)task_map_list_fn, 5, 4);
+    lean_closure_set(c, 0, waiting);
+    lean_closure_set(c, 1, f);
+    lean_closure_set(c, 2, ts);
+    lean_closure_set(c, 3, lean_box(i));
+    lean_task_object * new_task = alloc_task(c, prio, keep_alive);
+    if (i < n)
+        g_task_manager->add_dep(lean_to_task(waiting), new_task);
+    else
+        g_task_manager->enqueue(new_task);
+    return (lean_object*)new_task;
+}
+
 extern "C" LEAN_EXPORT bool lean_io_check_canceled_core() {
     if (lean_task_object * t = g_current_task_object) {
         lean_assert(t->m_imp); // task is being executed
@@ -1049,7 +2242,7 @@ extern "C" LEAN_EXPORT b_obj_res lean_io_wait_any_core(b_obj_arg task_list) {
 
 // Internally, a `Promise` is just a `Task` that is in the "Promised" or "Finished" state
 
-extern "C" LEAN_EXPORT obj_res lean_io_promise_new(obj_arg) {
+static lean_task_object * alloc_promise() {
     lean_always_assert(g_task_manager);
     bool keep_alive = false;
     unsigned prio = 0;
@@ -1058,11 +2251,43 @@ extern "C" LEAN_EXPORT obj_res lean_io_promise_new(obj_arg) {
     lean_set_task_header((lean_object*)o);
     o->m_value = nullptr;
     o->m_imp   = alloc_task_imp(closure, prio, keep_alive);
-    return io_result_mk_ok((lean_object *) o);
+    if (trace_events_enabled()) trace_task_created(o);
+    return o;
+}
+
+obj_res promise_new() {
+    return (lean_object *) alloc_promise();
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_promise_new(obj_arg) {
+    return io_result_mk_ok(promise_new());
+}
+
+/* sleepTask (ms : UInt32) : BaseIO (Task Unit) */
+extern "C" LEAN_EXPORT obj_res lean_io_sleep_task(uint32 ms, obj_arg) {
+#if defined(LEAN_MULTI_THREAD)
+    if (g_task_manager) {
+        lean_task_object * promise = alloc_promise();
+        {
+            lock_guard<mutex> _(*g_timer_manager_mutex);
+            if (!g_timer_manager)
+                g_timer_manager = new timer_manager();
+        }
+        lean_inc_ref((lean_object *)promise);
+        g_timer_manager->add(ms, promise);
+        return io_result_mk_ok((lean_object *)promise);
+    }
+#endif
+    this_thread::sleep_for(chrono::milliseconds(ms));
+    return io_result_mk_ok(lean_task_pure(box(0)));
+}
+
+void promise_resolve(obj_arg v, b_obj_arg promise) {
+    g_task_manager->resolve(lean_to_task(promise), v);
 }
 
 extern "C" LEAN_EXPORT obj_res lean_io_promise_resolve(obj_arg value, b_obj_arg promise, obj_arg) {
-    g_task_manager->resolve(lean_to_task(promise), value);
+    promise_resolve(value, promise);
     return io_result_mk_ok(box(0));
 }
 
@@ -1592,15 +2817,30 @@ extern "C" LEAN_EXPORT obj_res lean_float_frexp(double a) {
 
 static inline char * w_string_cstr(object * o) { lean_assert(lean_is_string(o)); return lean_to_string(o)->m_data; }
 
+/* The hash of a string object that is only reachable from the current thread is cached in the last 8 bytes of its
+   capacity if they are not in use, which is marked by setting `m_other` to `LEAN_STRING_HASH_CACHED`.
+   We do not cache the hash of multi-threaded objects to avoid racy writes, nor of persistent objects since they may
+   be stored in read-only memory. Functions updating an exclusive string destructively must invalidate the cache.
+   Strings of at least `LEAN_STRING_HASH_CACHE_MIN` bytes are allocated with enough capacity for caching their hash. */
+#define LEAN_STRING_HASH_CACHED    1
+#define LEAN_STRING_HASH_CACHE_MIN 64
+
+static inline void string_invalidate_hash(object * o) {
+    lean_to_string(o)->m_header.m_other = 0;
+}
+
 static object * string_ensure_capacity(object * o, size_t extra) {
     lean_assert(is_exclusive(o));
     size_t sz  = string_size(o);
     size_t cap = string_capacity(o);
     if (sz + extra > cap) {
-        object * new_o = alloc_string(sz, cap + sz + extra, string_len(o));
+        /* Use the slack of the current allocation before growing it */
+        size_t new_cap = lean_alloc_capacity(sizeof(lean_string_object), 1, cap);
+        if (sz + extra > new_cap)
+            new_cap = lean_alloc_capacity(sizeof(lean_string_object), 1, cap + sz + extra);
+        object * new_o = lean_realloc_object(o, lean_string_byte_size(o), sizeof(lean_string_object) + new_cap);
+        lean_to_string(new_o)->m_capacity = new_cap;
         lean_assert(string_capacity(new_o) >= sz + extra);
-        memcpy(w_string_cstr(new_o), string_cstr(o), sz);
-        lean_dealloc(o, lean_string_byte_size(o));
         return new_o;
     } else {
         return o;
@@ -1609,9 +2849,12 @@ static object * string_ensure_capacity(object * o, size_t extra) {
 
 extern "C" LEAN_EXPORT object * lean_mk_string_unchecked(char const * s, size_t sz, size_t len) {
     size_t rsz = sz + 1;
-    object * r = lean_alloc_string(rsz, rsz, len);
+    size_t cap = sz >= LEAN_STRING_HASH_CACHE_MIN ? rsz + sizeof(uint64) : rsz;
+    object * r = lean_alloc_string(rsz, cap, len);
     memcpy(w_string_cstr(r), s, sz);
     w_string_cstr(r)[sz] = 0;
+    /* Do not leave the reserved hash slot uninitialized */
+    memset(w_string_cstr(r) + rsz, 0, cap - rsz);
     return r;
 }
 
@@ -1696,6 +2939,7 @@ extern "C" LEAN_EXPORT object * lean_string_push(object * s, unsigned c) {
         lean_dec_ref(s);
     } else {
         r = string_ensure_capacity(s, 5);
+        string_invalidate_hash(r);
     }
     unsigned consumed = push_unicode_scalar(w_string_cstr(r) + sz - 1, c);
     lean_to_string(r)->m_size   = sz + consumed;
@@ -1719,6 +2963,7 @@ extern "C" LEAN_EXPORT object * lean_string_append(object * s1, object * s2) {
     } else {
         lean_assert(s1 != s2);
         r = string_ensure_capacity(s1, sz2-1);
+        string_invalidate_hash(r);
     }
     memcpy(w_string_cstr(r) + sz1 - 1, lean_string_cstr(s2), sz2 - 1);
     lean_to_string(r)->m_size   = new_sz;
@@ -1995,9 +3240,80 @@ extern "C" LEAN_EXPORT obj_res lean_string_utf8_extract(b_obj_arg s, b_obj_arg b
     /* In the reference implementation if `e` is not pointing to a valid UTF8
        character start position, it is assumed to be at the end. */
     if (e < sz && !is_utf8_first_byte(str[e])) e = sz;
+    if (b == 0 && e == sz) {
+        /* Strings are immutable values, so extracting all of `s` (e.g. in `Substring.toString` of a full
+           substring) can share it instead of copying it. */
+        lean_inc_ref(s);
+        return s;
+    }
     usize new_sz = e - b;
     lean_assert(new_sz > 0);
-    return lean_mk_string_from_bytes_unchecked(lean_string_cstr(s) + b, new_sz);
+    if (lean_string_len(s) == sz) {
+        /* `s` is ASCII, so we do not need to count the characters of the result */
+        return lean_mk_string_unchecked(str + b, new_sz, new_sz);
+    }
+    return lean_mk_string_from_bytes_unchecked(str + b, new_sz);
+}
+
+/* Returns the first occurrence of the `m` bytes at `needle` in the `n` bytes at `haystack`, or `nullptr` */
+static char const * find_bytes(char const * haystack, size_t n, char const * needle, size_t m) {
+    lean_assert(m > 0);
+#if defined(__GLIBC__) || defined(__APPLE__)
+    return static_cast<char const *>(memmem(haystack, n, needle, m));
+#else
+    char const * end = haystack + n;
+    while (static_cast<size_t>(end - haystack) >= m) {
+        char const * p = static_cast<char const *>(memchr(haystack, needle[0], end - haystack - m + 1));
+        if (p == nullptr)
+            return nullptr;
+        if (memcmp(p + 1, needle + 1, m - 1) == 0)
+            return p;
+        haystack = p + 1;
+    }
+    return nullptr;
+#endif
+}
+
+/* String.findStr (s : @& String) (pattern : @& String) (start : @& Pos) : Pos
+
+   As encodings of valid UTF-8 strings, an occurrence of the bytes of `pattern` can only start at a character
+   boundary of `s` and is an occurrence of its characters. */
+extern "C" LEAN_EXPORT obj_res lean_string_find(b_obj_arg s, b_obj_arg pattern, b_obj_arg start0) {
+    usize m = lean_string_size(pattern) - 1;
+    if (m == 0) {
+        lean_inc(start0);
+        return start0;
+    }
+    usize n = lean_string_size(s) - 1;
+    if (!lean_is_scalar(start0))
+        return lean_box(n);
+    usize start = lean_unbox(start0);
+    if (start > n || n - start < m)
+        return lean_box(n);
+    char const * str = lean_string_cstr(s);
+    char const * p   = find_bytes(str + start, n - start, lean_string_cstr(pattern), m);
+    return lean_box(p ? p - str : n);
+}
+
+/* String.countChar (s : @& String) (c : Char) : Nat */
+extern "C" LEAN_EXPORT obj_res lean_string_count_char(b_obj_arg s, uint32 c) {
+    char buf[4];
+    unsigned m = push_unicode_scalar(buf, c);
+    char const * it  = lean_string_cstr(s);
+    char const * end = it + lean_string_size(s) - 1;
+    size_t r = 0;
+    if (m == 1) {
+        while (char const * p = static_cast<char const *>(memchr(it, buf[0], end - it))) {
+            r++;
+            it = p + 1;
+        }
+    } else {
+        while (char const * p = find_bytes(it, end - it, buf, m)) {
+            r++;
+            it = p + m;
+        }
+    }
+    return lean_usize_to_nat(r);
 }
 
 extern "C" LEAN_EXPORT obj_res lean_string_utf8_prev(b_obj_arg s, b_obj_arg i0) {
@@ -2037,6 +3353,7 @@ extern "C" LEAN_EXPORT obj_res lean_string_utf8_set(obj_arg s, b_obj_arg i0, uin
     if (lean_is_exclusive(s)) {
         if (static_cast<unsigned char>(str[i]) < 128 && c < 128) {
             str[i] = c;
+            string_invalidate_hash(s);
             return s;
         }
     }
@@ -2055,7 +3372,21 @@ extern "C" LEAN_EXPORT obj_res lean_string_utf8_set(obj_arg s, b_obj_arg i0, uin
 extern "C" LEAN_EXPORT uint64 lean_string_hash(b_obj_arg s) {
     usize sz = lean_string_size(s) - 1;
     char const * str = lean_string_cstr(s);
-    return hash_str(sz, (unsigned char const *) str, 11);
+    if (sz < LEAN_STRING_HASH_CACHE_MIN || !lean_is_st(s))
+        return hash_str(sz, (unsigned char const *) str, 11);
+    lean_string_object * o = lean_to_string(s);
+    char * slot = o->m_data + o->m_capacity - sizeof(uint64);
+    uint64 h;
+    if (o->m_header.m_other == LEAN_STRING_HASH_CACHED) {
+        memcpy(&h, slot, sizeof(uint64));
+    } else {
+        h = hash_str(sz, (unsigned char const *) str, 11);
+        if (o->m_capacity >= o->m_size + sizeof(uint64)) {
+            memcpy(slot, &h, sizeof(uint64));
+            o->m_header.m_other = LEAN_STRING_HASH_CACHED;
+        }
+    }
+    return h;
 }
 
 extern "C" LEAN_EXPORT obj_res lean_string_of_usize(size_t n) {
@@ -2103,8 +3434,15 @@ extern "C" LEAN_EXPORT obj_res lean_sarray_ensure_capacity(obj_arg a, size_t min
     size_t cap = lean_sarray_capacity(a);
     if (min_cap <= cap) {
         return a;
+    }
+    unsigned esz = lean_sarray_elem_size(a);
+    size_t new_cap = lean_alloc_capacity(sizeof(lean_sarray_object), esz, exact ? min_cap : min_cap * 2);
+    if (lean_is_exclusive(a)) {
+        object * r = lean_realloc_object(a, lean_sarray_byte_size(a), sizeof(lean_sarray_object) + esz*new_cap);
+        lean_to_sarray(r)->m_capacity = new_cap;
+        return r;
     } else {
-        return lean_copy_sarray(a, exact ? min_cap : min_cap * 2);
+        return lean_copy_sarray(a, new_cap);
     }
 }
 
@@ -2147,6 +3485,19 @@ extern "C" LEAN_EXPORT obj_res lean_byte_array_push(obj_arg a, uint8 b) {
     return r;
 }
 
+/* ByteArray.indexOf? (a : @& ByteArray) (b : UInt8) (start : @& Nat) : Option Nat */
+extern "C" LEAN_EXPORT obj_res lean_byte_array_index_of(b_obj_arg a, uint8 b, b_obj_arg start0) {
+    usize sz = lean_sarray_size(a);
+    if (!lean_is_scalar(start0) || lean_unbox(start0) >= sz)
+        return mk_option_none();
+    usize start   = lean_unbox(start0);
+    uint8 * data  = lean_sarray_cptr(a);
+    void const * p = memchr(data + start, b, sz - start);
+    if (p == nullptr)
+        return mk_option_none();
+    return mk_option_some(lean_usize_to_nat(static_cast<uint8 const *>(p) - data));
+}
+
     extern "C" LEAN_EXPORT obj_res lean_byte_array_copy_slice(b_obj_arg src, obj_arg o_src_off, obj_arg dest, obj_arg o_dest_off, obj_arg o_len, bool exact) {
     size_t ssz = lean_sarray_size(src);
     size_t dsz = lean_sarray_size(dest);
@@ -2241,7 +3592,17 @@ extern "C" LEAN_EXPORT obj_res lean_copy_expand_array(obj_arg a, bool expand) {
     size_t sz      = lean_array_size(a);
     size_t cap     = lean_array_capacity(a);
     lean_assert(cap >= sz);
-    if (expand) cap = (cap + 1) * 2;
+    if (expand && lean_is_exclusive(a)) {
+        /* Grow `a` in place if its allocation has enough slack, and let the allocator avoid the copy otherwise
+           if possible. The elements are moved, so there is no need to touch their reference counters. */
+        size_t new_cap = lean_alloc_capacity(sizeof(lean_array_object), sizeof(void*), cap);
+        if (new_cap <= sz)
+            new_cap = lean_alloc_capacity(sizeof(lean_array_object), sizeof(void*), (cap + 1) * 2);
+        object * r = lean_realloc_object(a, lean_array_byte_size(a), sizeof(lean_array_object) + sizeof(void*)*new_cap);
+        lean_to_array(r)->m_capacity = new_cap;
+        return r;
+    }
+    if (expand) cap = lean_alloc_capacity(sizeof(lean_array_object), sizeof(void*), (cap + 1) * 2);
     lean_assert(!expand || cap > sz);
     object * r     = lean_alloc_array(sz, cap);
     object ** it   = lean_array_cptr(a);
@@ -2341,6 +3702,7 @@ extern "C" LEAN_EXPORT object * lean_dbg_trace(obj_arg s, obj_arg fn) {
 }
 
 extern "C" LEAN_EXPORT object * lean_dbg_sleep(uint32 ms, obj_arg fn) {
+    flush_mt_rc_cache();
     chrono::milliseconds c(ms);
     this_thread::sleep_for(c);
     return lean_apply_1(fn, lean_box(0));
@@ -2376,11 +3738,46 @@ void initialize_object() {
     g_ext_classes_mutex = new mutex();
     g_array_empty       = lean_alloc_array(0, 0);
     mark_persistent(g_array_empty);
+#if defined(LEAN_MULTI_THREAD)
+    g_timer_manager_mutex = new mutex();
+    g_mark_mt_pool_mutex = new mutex();
+#endif
+    g_task_trace_mutex  = new mutex();
+    g_task_trace_infos  = new std::unordered_map<lean_task_object *, task_trace_info>();
+#ifndef LEAN_EMSCRIPTEN
+    if (char const * mark_mt_threads = std::getenv("LEAN_MARK_MT_THREADS")) {
+        g_mark_mt_threads = atoi(mark_mt_threads);
+    }
+    if (char const * rc_cache = std::getenv("LEAN_MT_RC_CACHE")) {
+        g_mt_rc_cache_enabled = *rc_cache && strcmp(rc_cache, "0") != 0;
+    }
+    if (char const * deferred = std::getenv("LEAN_DEFERRED_FREE")) {
+        if (*deferred && strcmp(deferred, "0") != 0) {
+            g_free_budget = LEAN_DEFAULT_FREE_BUDGET;
+            if (char const * budget = std::getenv("LEAN_FREE_BUDGET"))
+                g_free_budget = std::max<size_t>(std::strtoull(budget, nullptr, 10), 1);
+        }
+    }
+#endif
 }
 
 void finalize_object() {
+    flush_mt_rc_cache();
+    free_deferred_slice(SIZE_MAX);
+#if defined(LEAN_MULTI_THREAD)
+    delete g_reclaimer;
+    g_reclaimer = nullptr;
+#endif
     for (external_object_class * cls : *g_ext_classes) delete cls;
     delete g_ext_classes;
     delete g_ext_classes_mutex;
+    delete g_task_trace_infos;
+    delete g_task_trace_mutex;
+#if defined(LEAN_MULTI_THREAD)
+    delete g_timer_manager_mutex;
+    delete g_mark_mt_pool;
+    g_mark_mt_pool = nullptr;
+    delete g_mark_mt_pool_mutex;
+#endif
 }
 }
@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <string>
+#include <iosfwd>
 #include <lean/lean.h>
 #include "runtime/mpz.h"
 
@@ -291,6 +292,10 @@ inline bool io_check_canceled_core() { return lean_io_check_canceled_core(); }
 inline void io_cancel_core(b_obj_arg t) { return lean_io_cancel_core(t); }
 inline bool io_get_task_state_core(b_obj_arg t) { return lean_io_get_task_state_core(t); }
 inline b_obj_res io_wait_any_core(b_obj_arg task_list) { return lean_io_wait_any_core(task_list); }
+/* Create a promise, i.e. a task finished by `promise_resolve`. Requires a task manager. */
+obj_res promise_new();
+/* Consumes `v`. Only the first call for a given promise has an effect. */
+void promise_resolve(obj_arg v, b_obj_arg promise);
 
 // =======================================
 // External
@@ -475,6 +480,12 @@ inline obj_res st_ref_swap(b_obj_arg r, obj_arg v, obj_arg w) { return lean_st_r
 
 // =======================================
 // Module initialization/finalization
+/* Histogram of the pauses caused by freeing large object graphs in deferred mode (`LEAN_DEFERRED_FREE`) */
+void display_free_stats(std::ostream & out);
+/* Number of objects marked by `lean_mark_mt`, only available when compiled with RUNTIME_STATS=ON */
+void display_mark_mt_stats(std::ostream & out);
+/* Number of tasks run and threads spawned by dedicated workers */
+void display_task_stats(std::ostream & out);
 void initialize_object();
 void finalize_object();
 }
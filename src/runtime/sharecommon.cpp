@@ -14,6 +14,11 @@ namespace lean {
 extern "C" LEAN_EXPORT uint8 lean_sharecommon_eq(b_obj_arg o1, b_obj_arg o2) {
     lean_assert(!lean_is_scalar(o1));
     lean_assert(!lean_is_scalar(o2));
+    if (lean_is_string(o1) && lean_is_string(o2)) {
+        /* The capacity of a string and `m_other`, which marks a cached hash, are irrelevant for its value */
+        size_t sz = lean_string_size(o1);
+        return sz == lean_string_size(o2) && memcmp(lean_string_cstr(o1), lean_string_cstr(o2), sz) == 0;
+    }
     size_t sz1 = lean_object_byte_size(o1);
     size_t sz2 = lean_object_byte_size(o2);
     if (sz1 != sz2) return false;
@@ -28,6 +33,10 @@ extern "C" LEAN_EXPORT uint8 lean_sharecommon_eq(b_obj_arg o1, b_obj_arg o2) {
 
 extern "C" LEAN_EXPORT uint64_t lean_sharecommon_hash(b_obj_arg o) {
     lean_assert(!lean_is_scalar(o));
+    if (lean_is_string(o)) {
+        // must be consistent with `lean_sharecommon_eq`
+        return hash_str(lean_string_size(o), reinterpret_cast<unsigned char const *>(lean_string_cstr(o)), LeanString);
+    }
     size_t sz = lean_object_byte_size(o);
     size_t header_sz = sizeof(lean_object);
     // hash relevant parts of the header
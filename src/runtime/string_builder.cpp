@@ -0,0 +1,204 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <lean/lean.h>
+#include "runtime/string_builder.h"
+#include "runtime/io.h"
+#include "runtime/object.h"
+#include "runtime/thread.h"
+#include "runtime/utf8.h"
+
+/* Strings of at least this many bytes are shared instead of copied when appended to a builder */
+#define LEAN_STRING_BUILDER_SHARE_MIN 64
+
+namespace lean {
+/* Mutable sequence of string pieces that supports appending in amortized constant time, independently of whether
+   the appended string is shared, and is flattened into a single string only once at the end or written to a file
+   piece by piece. Short appended strings and characters are copied into a single growing buffer, while long strings
+   are shared.
+
+   Like `IO.Ref`, a builder may be used by multiple threads, so all operations take a lock. */
+class string_builder {
+    struct piece {
+        /* shared string, or `nullptr` if the piece is stored in `m_buffer` */
+        object * m_str;
+        size_t   m_offset;
+        size_t   m_size;
+    };
+    mutex              m_mutex;
+    std::vector<piece> m_pieces;
+    std::string        m_buffer;
+    size_t             m_size{0};
+    size_t             m_length{0};
+
+    char const * piece_data(piece const & p) const {
+        return p.m_str ? lean_string_cstr(p.m_str) : m_buffer.data() + p.m_offset;
+    }
+
+    /* Extend the last piece if it is stored in the buffer, or start a new one */
+    void buffer_appended(size_t offset, size_t sz) {
+        if (!m_pieces.empty() && m_pieces.back().m_str == nullptr)
+            m_pieces.back().m_size += sz;
+        else
+            m_pieces.push_back(piece{nullptr, offset, sz});
+    }
+
+    void clear() {
+        for (piece const & p : m_pieces) {
+            if (p.m_str) dec(p.m_str);
+        }
+        m_pieces.clear();
+        m_buffer.clear();
+    }
+
+public:
+    ~string_builder() { clear(); }
+
+    void append(b_obj_arg s, bool mt) {
+        size_t sz = lean_string_size(s) - 1;
+        if (sz == 0)
+            return;
+        lock_guard<mutex> _(m_mutex);
+        if (sz >= LEAN_STRING_BUILDER_SHARE_MIN) {
+            /* values reachable from a multi-threaded builder must be multi-threaded as well */
+            if (mt) mark_mt(s);
+            inc(s);
+            m_pieces.push_back(piece{s, 0, sz});
+        } else {
+            size_t offset = m_buffer.size();
+            m_buffer.append(lean_string_cstr(s), sz);
+            buffer_appended(offset, sz);
+        }
+        m_size   += sz;
+        m_length += lean_string_len(s);
+    }
+
+    void push(unsigned c) {
+        lock_guard<mutex> _(m_mutex);
+        size_t offset = m_buffer.size();
+        push_unicode_scalar(m_buffer, c);
+        size_t sz = m_buffer.size() - offset;
+        buffer_appended(offset, sz);
+        m_size   += sz;
+        m_length += 1;
+    }
+
+    size_t size() {
+        lock_guard<mutex> _(m_mutex);
+        return m_size;
+    }
+
+    size_t length() {
+        lock_guard<mutex> _(m_mutex);
+        return m_length;
+    }
+
+    /* Flatten the pieces into a single string, which replaces them so that repeated calls do not copy again */
+    obj_res to_string(bool mt) {
+        lock_guard<mutex> _(m_mutex);
+        if (m_pieces.size() == 1 && m_pieces[0].m_str) {
+            inc(m_pieces[0].m_str);
+            return m_pieces[0].m_str;
+        }
+        object * r = lean_alloc_string(m_size + 1, m_size + 1, m_length);
+        char * it  = lean_to_string(r)->m_data;
+        for (piece const & p : m_pieces) {
+            memcpy(it, piece_data(p), p.m_size);
+            it += p.m_size;
+        }
+        *it = 0;
+        clear();
+        if (m_size > 0) {
+            if (mt) mark_mt(r);
+            inc(r);
+            m_pieces.push_back(piece{r, 0, m_size});
+        }
+        return r;
+    }
+
+    /* Returns `false` and sets `errno` on failure */
+    bool write(FILE * fp) {
+        lock_guard<mutex> _(m_mutex);
+        for (piece const & p : m_pieces) {
+            if (std::fwrite(piece_data(p), 1, p.m_size, fp) != p.m_size)
+                return false;
+        }
+        return true;
+    }
+
+    void for_each_piece(b_obj_arg fn) {
+        lock_guard<mutex> _(m_mutex);
+        for (piece const & p : m_pieces) {
+            if (p.m_str) {
+                inc(fn); inc(p.m_str);
+                apply_1(fn, p.m_str);
+            }
+        }
+    }
+};
+
+static lean_external_class * g_string_builder_external_class = nullptr;
+static void string_builder_finalizer(void * h) {
+    delete static_cast<string_builder *>(h);
+}
+static void string_builder_foreach(void * h, b_obj_arg fn) {
+    static_cast<string_builder *>(h)->for_each_piece(fn);
+}
+
+static string_builder * string_builder_get(b_obj_arg b) {
+    return static_cast<string_builder *>(lean_get_external_data(b));
+}
+
+/* StringBuilder.new : BaseIO StringBuilder */
+extern "C" LEAN_EXPORT obj_res lean_io_string_builder_new(obj_arg) {
+    return io_result_mk_ok(lean_alloc_external(g_string_builder_external_class, new string_builder()));
+}
+
+/* StringBuilder.append (b : @& StringBuilder) (s : @& String) : BaseIO Unit */
+extern "C" LEAN_EXPORT obj_res lean_io_string_builder_append(b_obj_arg b, b_obj_arg s, obj_arg) {
+    string_builder_get(b)->append(s, !lean_is_st(b));
+    return io_result_mk_ok(box(0));
+}
+
+/* StringBuilder.push (b : @& StringBuilder) (c : Char) : BaseIO Unit */
+extern "C" LEAN_EXPORT obj_res lean_io_string_builder_push(b_obj_arg b, uint32 c, obj_arg) {
+    string_builder_get(b)->push(c);
+    return io_result_mk_ok(box(0));
+}
+
+/* StringBuilder.size (b : @& StringBuilder) : BaseIO Nat */
+extern "C" LEAN_EXPORT obj_res lean_io_string_builder_size(b_obj_arg b, obj_arg) {
+    return io_result_mk_ok(usize_to_nat(string_builder_get(b)->size()));
+}
+
+/* StringBuilder.length (b : @& StringBuilder) : BaseIO Nat */
+extern "C" LEAN_EXPORT obj_res lean_io_string_builder_length(b_obj_arg b, obj_arg) {
+    return io_result_mk_ok(usize_to_nat(string_builder_get(b)->length()));
+}
+
+/* StringBuilder.toString (b : @& StringBuilder) : BaseIO String */
+extern "C" LEAN_EXPORT obj_res lean_io_string_builder_to_string(b_obj_arg b, obj_arg) {
+    return io_result_mk_ok(string_builder_get(b)->to_string(!lean_is_st(b)));
+}
+
+/* StringBuilder.writeTo (b : @& StringBuilder) (h : @& FS.Handle) : IO Unit */
+extern "C" LEAN_EXPORT obj_res lean_io_string_builder_write_to(b_obj_arg b, b_obj_arg h, obj_arg) {
+    if (string_builder_get(b)->write(io_get_handle(h))) {
+        return io_result_mk_ok(box(0));
+    } else {
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+}
+
+void initialize_string_builder() {
+    g_string_builder_external_class = lean_register_external_class(string_builder_finalizer, string_builder_foreach);
+}
+
+void finalize_string_builder() {
+}
+}
@@ -7,11 +7,19 @@ Author: Leonardo de Moura
 #include <utility>
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
 #ifdef LEAN_WINDOWS
 #include <windows.h>
 #else
 #include <pthread.h>
 #endif
+#ifdef __linux__
+#include <sched.h>
+#endif
 #include <lean/config.h>
 #include "runtime/thread.h"
 #include "runtime/interrupt.h"
@@ -157,6 +165,144 @@ lthread::~lthread() {}
 void lthread::join() { m_imp->join(); }
 #endif
 
+/* Limits on the number of CPUs usable by this process, 0 if not limited/unknown */
+struct cpu_limits {
+    unsigned         m_hardware{0};
+    unsigned         m_affinity{0};
+    unsigned         m_cgroup_quota{0};
+    /* CPUs in the affinity mask */
+    std::vector<int> m_cpus;
+    bool             m_pin{false};
+};
+
+#if defined(LEAN_MULTI_THREAD) && defined(__linux__)
+/* Returns the CPU quota of a cgroup directory, rounded up, or 0 if there is none. */
+static unsigned read_cgroup_quota(std::string const & dir, bool v2) {
+    long quota = -1, period = 0;
+    if (v2) {
+        // "max 100000" or "<quota> <period>"
+        std::ifstream in(dir + "/cpu.max");
+        std::string q;
+        if (!(in >> q >> period) || q == "max")
+            return 0;
+        quota = std::atol(q.c_str());
+    } else {
+        std::ifstream in_quota(dir + "/cpu.cfs_quota_us");
+        std::ifstream in_period(dir + "/cpu.cfs_period_us");
+        if (!(in_quota >> quota) || !(in_period >> period))
+            return 0;
+    }
+    if (quota <= 0 || period <= 0)
+        return 0;
+    return std::max<long>(1, (quota + period - 1) / period);
+}
+
+/* Returns the smallest CPU quota of the cgroup of this process and its ancestors, or 0 if there is none. */
+static unsigned get_cgroup_cpu_quota() {
+    std::ifstream in("/proc/self/cgroup");
+    std::string line;
+    unsigned result = 0;
+    auto update = [&](unsigned q) { if (q && (!result || q < result)) result = q; };
+    while (std::getline(in, line)) {
+        // "<id>:<controllers>:<path>", where cgroup v2 uses "0::<path>"
+        size_t c1 = line.find(':');
+        size_t c2 = c1 == std::string::npos ? c1 : line.find(':', c1 + 1);
+        if (c2 == std::string::npos)
+            continue;
+        std::string controllers = line.substr(c1 + 1, c2 - c1 - 1);
+        std::string path = line.substr(c2 + 1);
+        bool v2 = controllers.empty();
+        std::string root;
+        if (v2) {
+            root = "/sys/fs/cgroup";
+        } else {
+            std::stringstream ss(controllers);
+            std::string ctrl;
+            bool has_cpu = false;
+            while (std::getline(ss, ctrl, ','))
+                has_cpu = has_cpu || ctrl == "cpu";
+            if (!has_cpu)
+                continue;
+            root = "/sys/fs/cgroup/" + controllers;
+            std::ifstream probe(root + "/cpu.cfs_period_us");
+            if (!probe)
+                root = "/sys/fs/cgroup/cpu";
+        }
+        // Inside a container, the cgroup path may not exist under the mount point, which is then the
+        // container's own cgroup. Checking every prefix handles both cases as well as limits on ancestors.
+        while (true) {
+            update(read_cgroup_quota(root + path, v2));
+            if (path.empty() || path == "/")
+                break;
+            path = path.substr(0, path.rfind('/'));
+        }
+    }
+    return result;
+}
+#endif
+
+static cpu_limits compute_cpu_limits() {
+    cpu_limits l;
+#if defined(LEAN_MULTI_THREAD)
+    l.m_hardware = std::thread::hardware_concurrency();
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &set))
+                l.m_cpus.push_back(i);
+        }
+        l.m_affinity = l.m_cpus.size();
+    }
+    l.m_cgroup_quota = get_cgroup_cpu_quota();
+#endif
+    char const * pin = std::getenv("LEAN_PIN_THREADS");
+    l.m_pin = pin && *pin && std::string(pin) != "0";
+#endif
+    return l;
+}
+
+static cpu_limits const & get_cpu_limits() {
+    static cpu_limits l = compute_cpu_limits();
+    return l;
+}
+
+#if defined(LEAN_MULTI_THREAD)
+unsigned hardware_concurrency() {
+    cpu_limits const & l = get_cpu_limits();
+    unsigned r = l.m_hardware;
+    for (unsigned lim : {l.m_affinity, l.m_cgroup_quota}) {
+        if (lim && (!r || lim < r))
+            r = lim;
+    }
+    return r;
+}
+
+void pin_current_thread(unsigned idx) {
+    cpu_limits const & l = get_cpu_limits();
+    if (!l.m_pin || l.m_cpus.empty())
+        return;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(l.m_cpus[idx % l.m_cpus.size()], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)idx;
+#endif
+}
+#endif
+
+void display_cpu_config(std::ostream & out) {
+    cpu_limits const & l = get_cpu_limits();
+    auto show = [](unsigned n) { return n ? std::to_string(n) : std::string("none"); };
+    out << "available CPUs:                        " << hardware_concurrency()
+        << " (hardware: " << show(l.m_hardware) << ", affinity mask: " << show(l.m_affinity)
+        << ", cgroup quota: " << show(l.m_cgroup_quota) << ")\n";
+    out << "worker threads pinned to CPUs:         " << (l.m_pin ? "yes" : "no") << "\n";
+}
+
 LEAN_THREAD_VALUE(bool, g_finalizing, false);
 
 bool in_thread_finalization() {
@@ -48,7 +48,11 @@ using std::memory_order_acq_rel;
 using std::memory_order_seq_cst;
 using std::atomic_thread_fence;
 namespace this_thread = std::this_thread;
-inline unsigned hardware_concurrency() { return std::thread::hardware_concurrency(); }
+/** \brief Number of CPUs available to this process. Unlike `std::thread::hardware_concurrency`, this takes the
+    CPU affinity mask and cgroup CPU quotas (e.g. of a container) into account. */
+LEAN_EXPORT unsigned hardware_concurrency();
+/** \brief Pin the current thread to the `idx`-th available CPU (modulo their number) if `LEAN_PIN_THREADS` is set. */
+LEAN_EXPORT void pin_current_thread(unsigned idx);
 /** Simple thread class that allows us to set the thread stack size.
     We implement it using pthreads on OSX/Linux and WinThreads on Windows. */
 class LEAN_EXPORT lthread {
@@ -173,6 +177,7 @@ public:
     void unlock() {}
 };
 inline unsigned hardware_concurrency() { return 1; }
+inline void pin_current_thread(unsigned) {}
 }
 #endif
 
@@ -234,6 +239,9 @@ LEAN_EXPORT void delete_thread_finalizer_manager();
 
 LEAN_EXPORT bool in_thread_finalization();
 
+/** \brief Display the CPU limits used to compute `hardware_concurrency` and whether threads are pinned. */
+void display_cpu_config(std::ostream & out);
+
 /**
     \brief Add \c fn to the list of functions used to reset thread local storage.
 
@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include "runtime/trace_event.h"
+#include "runtime/thread.h"
+
+namespace lean {
+bool g_trace_events_enabled = false;
+/* Protected by `g_trace_events_mutex`, which is never deleted as other threads may still emit events while the
+   runtime is being finalized. */
+static FILE * g_trace_events_out = nullptr;
+static mutex * g_trace_events_mutex = nullptr;
+static chrono::steady_clock::time_point g_trace_events_start;
+static std::atomic<uint64_t> g_next_trace_event_id(1);
+static std::atomic<unsigned> g_next_trace_event_tid(1);
+LEAN_THREAD_VALUE(unsigned, g_trace_event_tid, 0);
+
+static unsigned trace_event_tid() {
+    if (g_trace_event_tid == 0)
+        g_trace_event_tid = g_next_trace_event_tid++;
+    return g_trace_event_tid;
+}
+
+static std::string escape(std::string const & s) {
+    std::string r;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            r += '\\';
+            r += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            r += buf;
+        } else {
+            r += c;
+        }
+    }
+    return r;
+}
+
+/* `fields` are the event-specific members of the event object */
+static void emit(std::string const & fields) {
+    unsigned tid = trace_event_tid();
+    lock_guard<mutex> _(*g_trace_events_mutex);
+    if (!g_trace_events_out)
+        return;
+    fprintf(g_trace_events_out, "{\"pid\":1,\"tid\":%u,%s},\n", tid, fields.c_str());
+}
+
+static std::string fmt_ts(char const * key, double ts) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%s\":%.3f", key, ts);
+    return buf;
+}
+
+void start_trace_events(char const * fname) {
+    {
+        lock_guard<mutex> _(*g_trace_events_mutex);
+        if (g_trace_events_out)
+            fclose(g_trace_events_out);
+        g_trace_events_out = fopen(fname, "w");
+        if (!g_trace_events_out) {
+            fprintf(stderr, "failed to open trace events file '%s'\n", fname);
+            g_trace_events_enabled = false;
+            return;
+        }
+        // Trailing commas and a missing closing bracket are explicitly allowed by the format
+        fputs("[\n", g_trace_events_out);
+        g_trace_events_start   = chrono::steady_clock::now();
+        g_trace_events_enabled = true;
+    }
+    set_trace_event_thread_name("main");
+}
+
+double trace_event_now() {
+    return chrono::duration<double, std::micro>(chrono::steady_clock::now() - g_trace_events_start).count();
+}
+
+uint64_t mk_trace_event_id() {
+    return g_next_trace_event_id++;
+}
+
+void set_trace_event_thread_name(std::string const & name) {
+    emit("\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":\"" + escape(name) + "\"}");
+}
+
+std::string trace_event_arg(char const * key, std::string const & value) {
+    return std::string("\"") + key + "\":\"" + escape(value) + "\"";
+}
+
+void trace_event_begin(std::string const & name, char const * cat, std::string const & args) {
+    emit("\"ph\":\"B\",\"name\":\"" + escape(name) + "\",\"cat\":\"" + cat + "\"," + fmt_ts("ts", trace_event_now()) +
+         ",\"args\":{" + args + "}");
+}
+
+void trace_event_end() {
+    emit("\"ph\":\"E\"," + fmt_ts("ts", trace_event_now()));
+}
+
+void trace_event_complete(std::string const & name, char const * cat, double start, double dur, std::string const & args) {
+    emit("\"ph\":\"X\",\"name\":\"" + escape(name) + "\",\"cat\":\"" + cat + "\"," + fmt_ts("ts", start) + "," +
+         fmt_ts("dur", dur) + ",\"args\":{" + args + "}");
+}
+
+void trace_event_flow_start(uint64_t id, double ts) {
+    emit("\"ph\":\"s\",\"name\":\"dep\",\"cat\":\"task\",\"id\":" + std::to_string(id) + "," + fmt_ts("ts", ts));
+}
+
+void trace_event_flow_end(uint64_t id, double ts) {
+    emit("\"ph\":\"f\",\"bp\":\"e\",\"name\":\"dep\",\"cat\":\"task\",\"id\":" + std::to_string(id) + "," + fmt_ts("ts", ts));
+}
+
+void initialize_trace_event() {
+    g_trace_events_mutex = new mutex;
+#ifndef LEAN_EMSCRIPTEN
+    if (char const * fname = std::getenv("LEAN_TRACE_EVENTS")) {
+        start_trace_events(fname);
+    }
+#endif
+}
+
+void finalize_trace_event() {
+    lock_guard<mutex> _(*g_trace_events_mutex);
+    if (g_trace_events_out) {
+        g_trace_events_enabled = false;
+        fputs("{\"pid\":1,\"ph\":\"M\",\"name\":\"process_name\",\"args\":{\"name\":\"lean\"}}]\n", g_trace_events_out);
+        fclose(g_trace_events_out);
+        g_trace_events_out = nullptr;
+    }
+}
+}
@@ -0,0 +1,39 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <string>
+#include <cstdint>
+
+namespace lean {
+/* Output of events in the Chrome trace event format, which can be viewed in `chrome://tracing` or
+   https://ui.perfetto.dev. Tracing is enabled by setting `LEAN_TRACE_EVENTS` to the name of the output
+   file or by `lean --trace-events=file`. */
+
+extern bool g_trace_events_enabled;
+inline bool trace_events_enabled() { return g_trace_events_enabled; }
+
+/* Start writing events to `fname`, replacing any previous output file. Should be called before any threads
+   are spawned. */
+void start_trace_events(char const * fname);
+
+/* Timestamp in microseconds since the start of the trace */
+double trace_event_now();
+/* Fresh identifier for tasks and flow events */
+uint64_t mk_trace_event_id();
+void set_trace_event_thread_name(std::string const & name);
+/* `"key":"value"` with `value` escaped */
+std::string trace_event_arg(char const * key, std::string const & value);
+
+/* `args` is either empty or a list of comma-separated JSON object members such as produced by `trace_event_arg`. */
+void trace_event_begin(std::string const & name, char const * cat, std::string const & args = "");
+void trace_event_end();
+void trace_event_complete(std::string const & name, char const * cat, double start, double dur, std::string const & args = "");
+/* Start/end of an arrow between the enclosing slices of the current thread. */
+void trace_event_flow_start(uint64_t id, double ts);
+void trace_event_flow_end(uint64_t id, double ts);
+
+void initialize_trace_event();
+void finalize_trace_event();
+}
@@ -5,6 +5,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include "runtime/debug.h"
 #include "runtime/optional.h"
@@ -32,28 +33,42 @@ unsigned get_utf8_size(unsigned char c) {
         return 1; /* invalid */
 }
 
+/* The functions below process 8 bytes at a time ("SIMD within a register"), which does not depend on any instruction
+   set extensions and speeds up the common case of (mostly) ASCII text. */
+#define LEAN_UTF8_HIGH_BITS 0x8080808080808080ull
+
+static inline uint64_t load_word(uint8_t const * p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/* Number of bytes in `w` that are not continuation bytes (`10xxxxxx`) */
+static inline unsigned num_non_continuation_bytes(uint64_t w) {
+    /* bit 7 of each byte is set iff it is set in `w` and bit 6 is not */
+    uint64_t cont = w & ~(w << 1) & LEAN_UTF8_HIGH_BITS;
+    /* sum the bits by multiplication, accumulating them in the most significant byte */
+    return 8 - static_cast<unsigned>(((cont >> 7) * 0x0101010101010101ull) >> 56);
+}
+
 extern "C" LEAN_EXPORT size_t lean_utf8_strlen(char const * str) {
-    size_t r = 0;
-    while (*str != 0) {
-        unsigned sz = get_utf8_size(*str);
-        r++;
-        str += sz;
-    }
-    return r;
+    return lean_utf8_n_strlen(str, strlen(str));
 }
 
 size_t utf8_strlen(char const * str) {
     return lean_utf8_strlen(str);
 }
 
+/* Assumes that `str` is valid UTF-8, in which case the number of code points is the number of bytes that are not
+   continuation bytes, independently of how the input is split into words. */
 extern "C" LEAN_EXPORT size_t lean_utf8_n_strlen(char const * str, size_t sz) {
+    uint8_t const * s = reinterpret_cast<uint8_t const *>(str);
     size_t r = 0;
     size_t i = 0;
-    while (i < sz) {
-        unsigned d = get_utf8_size(str[i]);
-        r++;
-        i += d;
-    }
+    for (; i + 8 <= sz; i += 8)
+        r += num_non_continuation_bytes(load_word(s + i));
+    for (; i < sz; i++)
+        r += !is_utf8_next(s[i]);
     return r;
 }
 
@@ -269,6 +284,19 @@ bool validate_utf8_one(uint8_t const * str, size_t size, size_t & pos) {
 
 bool validate_utf8(uint8_t const * str, size_t size, size_t & pos, size_t & i) {
     while (pos < size) {
+        if (str[pos] < 0x80) {
+            /* skip ASCII characters 8 at a time */
+            while (pos + 8 <= size && (load_word(str + pos) & LEAN_UTF8_HIGH_BITS) == 0) {
+                pos += 8;
+                i   += 8;
+            }
+            /* at most 7 remaining ASCII characters before the next non-ASCII one or the end */
+            while (pos < size && str[pos] < 0x80) {
+                pos++;
+                i++;
+            }
+            continue;
+        }
         if (!validate_utf8_one(str, size, pos)) return false;
         i++;
     }
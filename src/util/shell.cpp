@@ -23,6 +23,8 @@ Author: Leonardo de Moura
 #include "runtime/array_ref.h"
 #include "runtime/object_ref.h"
 #include "runtime/utf8.h"
+#include "runtime/trace_event.h"
+#include "runtime/alloc.h"
 #include "util/timer.h"
 #include "util/macros.h"
 #include "util/io.h"
@@ -224,6 +226,8 @@ static void display_help(std::ostream & out) {
     std::cout << "  --print-libdir     print the installation directory for Lean's built-in libraries and exit\n";
     std::cout << "  --profile          display elaboration/type checking time for each definition/theorem\n";
     std::cout << "  --stats            display environment statistics\n";
+    std::cout << "  --trace-events=file\n"
+              << "                     write task and profiling events in the Chrome trace event format to the given file\n";
     DEBUG_CODE(
     std::cout << "  --debug=tag        enable assertions with the given tag\n";
         )
@@ -263,6 +267,7 @@ static struct option g_long_options[] = {
 #endif
     {"plugin",       required_argument, 0, 'p'},
     {"load-dynlib",  required_argument, 0, 'l'},
+    {"trace-events", required_argument, 0, 'E'},
     {"json",         no_argument,       &json_output, 1},
     {"print-prefix", no_argument,       &print_prefix, 1},
     {"print-libdir", no_argument,       &print_libdir, 1},
@@ -615,6 +620,10 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
                 lean::load_dynlib(optarg);
                 forwarded_args.push_back(string_ref("--load-dynlib=" + std::string(optarg)));
                 break;
+            case 'E':
+                check_optarg("E");
+                lean::start_trace_events(optarg);
+                break;
             default:
                 std::cerr << "Unknown command line option\n";
                 display_help(std::cerr);
@@ -728,6 +737,12 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
         bool ok = unbox(r.snd().raw());
 
         if (stats) {
+            std::cout << "number of task manager threads:        " << num_threads << "\n";
+            display_cpu_config(std::cout);
+            display_alloc_stats(std::cout);
+            display_free_stats(std::cout);
+            display_mark_mt_stats(std::cout);
+            display_task_stats(std::cout);
             env.display_stats();
         }
 
@@ -0,0 +1,51 @@
+/-!
+Throughput benchmark for channels: 4 producer threads send `n` messages each to 4 consumer
+threads over a single channel, which is either the mutex-based `IO.Channel` or an unbounded or
+bounded `IO.NativeChannel`.
+-/
+
+def numThreads := 4
+
+def runMutex (n : Nat) : IO Nat := do
+  let ch : IO.Channel Nat ← IO.Channel.new
+  let consumers ← (List.range numThreads).mapM fun _ => IO.asTask (prio := .dedicated) do
+    let mut sum := 0
+    for v in ch.sync do
+      sum := sum + v
+    return sum
+  let producers ← (List.range numThreads).mapM fun _ => IO.asTask (prio := .dedicated) do
+    for i in [0:n] do
+      ch.send i
+  for p in producers do
+    IO.ofExcept (← IO.wait p)
+  ch.close
+  consumers.foldlM (fun acc c => return acc + (← IO.ofExcept (← IO.wait c))) 0
+
+def runNative (n : Nat) (capacity : Option Nat) : IO Nat := do
+  let ch : IO.NativeChannel Nat ← IO.NativeChannel.new capacity
+  let consumers ← (List.range numThreads).mapM fun _ => IO.asTask (prio := .dedicated) do
+    let mut sum := 0
+    repeat
+      match ← ch.recvSync? with
+      | some v => sum := sum + v
+      | none => break
+    return sum
+  let producers ← (List.range numThreads).mapM fun _ => IO.asTask (prio := .dedicated) do
+    for i in [0:n] do
+      ch.send i
+  for p in producers do
+    IO.ofExcept (← IO.wait p)
+  ch.close
+  consumers.foldlM (fun acc c => return acc + (← IO.ofExcept (← IO.wait c))) 0
+
+def main : List String → IO UInt32
+  | [mode, s] => do
+    let n := s.toNat!
+    let total ← match mode with
+      | "mutex"   => runMutex n
+      | "native"  => runNative n none
+      | "bounded" => runNative n (some 1024)
+      | _         => throw <| IO.userError s!"unknown mode {mode}"
+    IO.println s!"received: {total}"
+    return 0
+  | _ => return 1
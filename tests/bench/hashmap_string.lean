@@ -0,0 +1,19 @@
+import Lean.Data.HashMap
+open Lean
+
+/-- Long keys sharing a common prefix, as e.g. file paths of build artifacts. -/
+def mkKey (i : Nat) : String :=
+  s!"/home/user/projects/mathematics/.lake/packages/library/.lake/build/lib/Library/Module{i}/Submodule.olean"
+
+def main : List String → IO Unit
+| [n] => do
+  let keys := (List.range 100000).toArray.map mkKey
+  let mut m : HashMap String Nat := mkHashMap
+  for i in [0:keys.size] do
+    m := m.insert keys[i]! i
+  let mut total := 0
+  for _ in [0:n.toNat!] do
+    for k in keys do
+      total := total + (m.find? k).getD 0
+  IO.println s!"total: {total}"
+| _ => throw $ IO.userError "give number of iterations"
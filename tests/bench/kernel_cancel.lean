@@ -0,0 +1,30 @@
+import Lean
+
+/-!
+  Kernel type checking with and without a cancellation token, which the kernel polls in
+  `check_system` on every `whnf` and definitional equality check. -/
+
+open Lean
+
+def sumRange (n : Nat) : Nat := (List.range n).foldl (· + ·) 0
+
+def sumRangeDecl (n : Nat) : Declaration :=
+  let rhs := mkNatLit (sumRange n)
+  .thmDecl {
+    name := `sumRange_eq
+    levelParams := []
+    type := mkApp3 (mkConst ``Eq [levelOne]) (mkConst ``Nat) (mkApp (mkConst ``sumRange) (mkNatLit n)) rhs
+    value := mkApp2 (mkConst ``Eq.refl [levelOne]) (mkConst ``Nat) rhs }
+
+def check (cancelTk? : Option IO.CancelToken) : CoreM Nat := do
+  let start ← IO.monoMsNow
+  for _ in [0:20] do
+    match (← getEnv).addDecl (← getOptions) (sumRangeDecl 2000) cancelTk? with
+    | .ok _ => pure ()
+    | .error ex => throwKernelException ex
+  return (← IO.monoMsNow) - start
+
+#eval show CoreM Unit from do
+  let t₁ ← check none
+  let t₂ ← check (some (← IO.CancelToken.new))
+  IO.println s!"without cancel token: {t₁}ms, with cancel token: {t₂}ms"
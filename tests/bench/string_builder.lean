@@ -0,0 +1,22 @@
+/-! Generating C code for a large module by many small appends, as in `EmitC`. -/
+
+def emitFn (emit : String → IO Unit) (i : Nat) : IO Unit := do
+  emit s!"LEAN_EXPORT lean_object* l_fn_{i}(lean_object* x_1, lean_object* x_2) \{\n"
+  for j in [0:20] do
+    emit "lean_object* x_"; emit (toString (j + 3)); emit " = lean_ctor_get(x_1, "
+    emit (toString j); emit ");\n"
+    emit "lean_inc(x_"; emit (toString (j + 3)); emit ");\n"
+  emit "return x_2;\n}\n"
+
+def main : List String → IO Unit
+| ["string", n] => do
+  let r ← IO.mkRef ""
+  for i in [0:n.toNat!] do
+    emitFn (fun s => r.modify (· ++ s)) i
+  IO.println s!"size: {(← r.get).utf8ByteSize}"
+| ["builder", n] => do
+  let b ← IO.StringBuilder.new
+  for i in [0:n.toNat!] do
+    emitFn b.append i
+  IO.println s!"size: {(← b.toString).utf8ByteSize}"
+| _ => throw $ IO.userError "give mode (string or builder) and number of functions"
@@ -0,0 +1,14 @@
+/-- A line that needs no trimming, so that `trim` and `Substring.toString` extract the whole string. -/
+def mkLine (size : Nat) : String :=
+  "".pushn 'x' size
+
+def main : List String → IO Unit
+| [n] => do
+  let line := mkLine 1000000
+  let mut total := 0
+  for _ in [0:n.toNat!] do
+    total := total + line.trim.utf8ByteSize
+    total := total + line.toSubstring.toString.utf8ByteSize
+    total := total + (line.extract ⟨1⟩ ⟨1001⟩).length
+  IO.println s!"total: {total}"
+| _ => throw $ IO.userError "give number of iterations"
@@ -0,0 +1,26 @@
+/-!
+Stress test for the task manager: lots of tiny tasks spawned from within
+other tasks, plus a long chain of `Task.map`s.
+-/
+
+-- fan out a binary tree of tasks, each node spawning its children from a worker
+partial def tree (d : Nat) : Task Nat :=
+  if d = 0 then .pure 1
+  else
+    (Task.spawn fun _ => (tree (d - 1), tree (d - 1))).bind fun (l, r) =>
+      l.bind fun a => r.map fun b => a + b + 1
+
+-- a sequence of `n` dependent tasks
+def chain (n : Nat) : Task Nat := Id.run do
+  let mut t := Task.pure 0
+  for _ in [0:n] do
+    t := t.map (· + 1)
+  return t
+
+def main : List String → IO UInt32
+  | [s] => do
+    let n := s.toNat!
+    IO.println s!"tree of depth {n}: {(tree n).get} tasks"
+    IO.println s!"chain of length {2 ^ n}: {(chain (2 ^ n)).get}"
+    return 0
+  | _ => return 1
@@ -0,0 +1,23 @@
+/-!
+Stress test for forcing the same `Thunk` from many tasks at once: one of them evaluates
+the thunk while all others wait for its value.
+-/
+
+-- an expensive computation that barely allocates
+def work (n : Nat) : Nat := Id.run do
+  let mut acc := 0
+  for i in [0:n] do
+    acc := (acc + i * i) % 1000000007
+  return acc
+
+def main : List String → IO UInt32
+  | [s] => do
+    let n := s.toNat!
+    let mut total := 0
+    for _ in [0:20] do
+      let t : Thunk Nat := .mk fun _ => work n
+      let tasks := (List.range 64).map fun i => Task.spawn fun _ => t.get + i
+      total := total + tasks.foldl (fun acc task => acc + task.get) 0
+    IO.println s!"total: {total}"
+    return 0
+  | _ => return 1
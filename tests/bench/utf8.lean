@@ -0,0 +1,20 @@
+/-- Text of at least `size` bytes in which about `asciiPercent` percent of the characters are ASCII. -/
+def corpus (asciiPercent size : Nat) : ByteArray := Id.run do
+  let mut s := ""
+  let mut i := 0
+  while s.utf8ByteSize < size do
+    s := s.push <| if (i * 7919) % 100 < asciiPercent then Char.ofNat (97 + i % 26) else '∀'
+    i := i + 1
+  return s.toUTF8
+
+def main : List String → IO Unit
+| [n] => do
+  for pct in [100, 90, 50, 0] do
+    let bs := corpus pct 1000000
+    let mut total := 0
+    for _ in [0:n.toNat!] do
+      match String.fromUTF8? bs with
+      | some s => total := total + s.length
+      | none => throw <| IO.userError "invalid UTF-8"
+    IO.println s!"{pct}% ASCII: {total}"
+| _ => throw $ IO.userError "give number of iterations"
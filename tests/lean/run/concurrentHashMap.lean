@@ -0,0 +1,21 @@
+def test : IO Unit := do
+  let m : IO.ConcurrentHashMap String Nat ← IO.ConcurrentHashMap.new
+  let ts ← (List.range 4).mapM fun t => IO.asTask do
+    for i in [0:1000] do
+      discard <| m.insertIfAbsent (toString i) t
+  for t in ts do
+    IO.ofExcept (← IO.wait t)
+  unless (← m.size) == 1000 do
+    throw <| IO.userError s!"unexpected size {← m.size}"
+  m.insert "0" 42
+  unless (← m.get? "0") == some 42 do
+    throw <| IO.userError "insert did not replace the value"
+  unless (← m.insertIfAbsent "0" 1) == 42 do
+    throw <| IO.userError "insertIfAbsent replaced the value"
+  m.erase "0"
+  unless (← m.get? "0").isNone && (← m.size) == 999 do
+    throw <| IO.userError "erase failed"
+  unless (← m.getOrInsertWith "x" fun _ => 7) == 7 && (← m.getOrInsertWith "x" fun _ => 8) == 7 do
+    throw <| IO.userError "getOrInsertWith failed"
+
+#eval test
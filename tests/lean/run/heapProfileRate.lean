@@ -0,0 +1,21 @@
+/-!
+Runs `lean` with a heap profiler sampling interval smaller than most objects, so that most allocations are sampled.
+-/
+
+def input : System.FilePath := "heapProfileRate.lean.input"
+def profile : System.FilePath := "heapProfileRate.lean.pprof"
+
+#eval show IO Unit from do
+  IO.FS.writeFile input "prelude\ninductive T where\n  | a | b\n"
+  let out ← IO.Process.output {
+    cmd := "lean"
+    args := #[input.toString]
+    env := #[("LEAN_HEAP_PROFILE", some profile.toString), ("LEAN_HEAP_PROFILE_RATE", some "1")]
+  }
+  IO.FS.removeFile input
+  unless out.exitCode == 0 do
+    throw <| IO.userError s!"lean exited with code {out.exitCode}: {out.stderr}"
+  let size := (← IO.FS.readBinFile profile).size
+  IO.FS.removeFile profile
+  unless size > 0 do
+    throw <| IO.userError "empty heap profile"
@@ -0,0 +1,24 @@
+/-!
+Runs `lean` with the heap profiler sampling every allocation while growing an array beyond the size of medium
+objects, which is resized in place by `realloc`.
+-/
+
+def input : System.FilePath := "heapProfileRealloc.lean.input"
+def profile : System.FilePath := "heapProfileRealloc.lean.pprof"
+
+#eval show IO Unit from do
+  IO.FS.writeFile input "prelude\nimport Init.System.IO\n#eval (Nat.fold (fun i a => a.push i) 1000000 (#[] : Array Nat)).size\n"
+  let out ← IO.Process.output {
+    cmd := "lean"
+    args := #[input.toString]
+    env := #[("LEAN_HEAP_PROFILE", some profile.toString), ("LEAN_HEAP_PROFILE_RATE", some "1")]
+  }
+  IO.FS.removeFile input
+  unless out.exitCode == 0 do
+    throw <| IO.userError s!"lean exited with code {out.exitCode}: {out.stderr}"
+  unless out.stdout == "1000000\n" do
+    throw <| IO.userError s!"unexpected output: {out.stdout}"
+  let size := (← IO.FS.readBinFile profile).size
+  IO.FS.removeFile profile
+  unless size > 0 do
+    throw <| IO.userError "empty heap profile"
@@ -0,0 +1,34 @@
+def test (capacity : Option Nat) : IO Unit := do
+  let ch : IO.NativeChannel Nat ← IO.NativeChannel.new capacity
+  let consumer ← IO.asTask (prio := .dedicated) do
+    let mut sum := 0
+    repeat
+      match ← ch.recvSync? with
+      | some v => sum := sum + v
+      | none => break
+    return sum
+  for i in [0:1000] do
+    ch.send i
+  ch.close
+  let sum ← IO.ofExcept (← IO.wait consumer)
+  unless sum == 499500 do
+    throw <| IO.userError s!"unexpected sum {sum}"
+  unless (← ch.tryRecv?).isNone do
+    throw <| IO.userError "received from an empty channel"
+  if (← ch.trySend 1) then
+    throw <| IO.userError "sent to a closed channel"
+
+#eval test none
+#eval test (some 4)
+
+def testTrySend : IO Unit := do
+  let ch : IO.NativeChannel Nat ← IO.NativeChannel.new (some 2)
+  unless (← ch.trySend 1) && (← ch.trySend 2) do
+    throw <| IO.userError "trySend failed"
+  if (← ch.trySend 3) then
+    throw <| IO.userError "sent to a full channel"
+  let t ← ch.recv?
+  unless t.get == some 1 do
+    throw <| IO.userError "unexpected message"
+
+#eval testTrySend
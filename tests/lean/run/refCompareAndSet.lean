@@ -0,0 +1,36 @@
+def testRef : IO Unit := do
+  let r ← IO.mkRef (0 : Nat)
+  let v ← r.get
+  unless (← r.compareAndSet v 1) do
+    throw <| IO.userError "compareAndSet failed"
+  if (← r.compareAndSet v 2) then
+    throw <| IO.userError "compareAndSet succeeded on a stale value"
+  -- concurrent increments through a shared (multi-threaded) reference
+  let ts ← (List.range 8).mapM fun _ => IO.asTask do
+    for _ in [0:1000] do
+      r.modifyGetLockFree fun n => ((), n + 1)
+  for t in ts do
+    discard <| IO.ofExcept t.get
+  let n ← r.get
+  unless n == 8001 do
+    throw <| IO.userError s!"unexpected value {n}"
+  let b ← r.modifyGetLockFree fun n => (n * 2, n)
+  unless b == 16002 do
+    throw <| IO.userError s!"unexpected result {b}"
+
+def testCounter : IO Unit := do
+  let c ← IO.AtomicCounter.new
+  let ts ← (List.range 8).mapM fun _ => IO.asTask do
+    for _ in [0:1000] do
+      discard <| c.incr
+  for t in ts do
+    discard <| IO.ofExcept t.get
+  unless (← c.get) == 8000 do
+    throw <| IO.userError s!"unexpected count {← c.get}"
+  unless (← c.compareAndSet 8000 0) do
+    throw <| IO.userError "compareAndSet failed"
+  unless (← c.fetchAdd 5) == 0 && (← c.get) == 5 do
+    throw <| IO.userError "fetchAdd failed"
+
+#eval testRef
+#eval testCounter
@@ -177,3 +177,23 @@ info: [[2, 3, 4]]
 -/
 #guard_msgs in
 #eval (tst6 2).run
+
+@[noinline] def mkLongString (x : Nat) : String :=
+"".pushn 'a' 100 ++ toString x
+
+-- Long strings cache their hash, which must not affect sharing
+unsafe def tst7 (x : Nat) : ShareCommonT IO Unit := do
+let a := [mkLongString x]
+let b := [mkLongString x]
+check $ ptrAddrUnsafe a != ptrAddrUnsafe b
+check $ hash (mkLongString x) == hash a.head!
+let a ← shareCommonM a
+let b ← shareCommonM b
+check $ ptrAddrUnsafe a == ptrAddrUnsafe b
+IO.println (a.head!.length, b.head!.length)
+
+/--
+info: (101, 101)
+-/
+#guard_msgs in
+#eval (tst7 2).run
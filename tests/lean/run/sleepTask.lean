@@ -0,0 +1,16 @@
+def test : IO Unit := do
+  let start ← IO.monoMsNow
+  let ts ← (List.range 1000).mapM fun i => IO.sleepTask (UInt32.ofNat (50 - i % 50))
+  for t in ts do
+    IO.wait t
+  let elapsed := (← IO.monoMsNow) - start
+  unless elapsed ≥ 50 do
+    throw <| IO.userError s!"finished too early: {elapsed}ms"
+  -- the earliest timer finishes first
+  let first ← IO.sleepTask 1
+  let last ← IO.sleepTask 10000
+  IO.wait first
+  if (← IO.hasFinished last) then
+    throw <| IO.userError "late timer finished early"
+
+#eval test
@@ -0,0 +1,30 @@
+def testBuilder : IO Unit := do
+  let b ← IO.StringBuilder.new
+  let long := String.mk (List.replicate 100 'x')
+  let mut expected := ""
+  for i in [0:1000] do
+    let s := if i % 7 == 0 then "∀" else "ab"
+    b.append s
+    expected := expected ++ s
+    if i % 10 == 0 then
+      b.append long
+      expected := expected ++ long
+    if i % 13 == 0 then
+      b.push '😀'
+      expected := expected.push '😀'
+    if i == 500 then
+      unless (← b.toString) == expected do
+        throw <| IO.userError "unexpected intermediate contents"
+  unless (← b.toString) == expected do
+    throw <| IO.userError "unexpected contents"
+  unless (← b.size) == expected.utf8ByteSize && (← b.length) == expected.length do
+    throw <| IO.userError "unexpected size"
+  let path := "stringBuilder.out"
+  IO.FS.withFile path .write fun h => do
+    b.writeTo h
+    h.flush
+  unless (← IO.FS.readFile path) == expected do
+    throw <| IO.userError "unexpected file contents"
+  IO.FS.removeFile path
+
+#eval testBuilder
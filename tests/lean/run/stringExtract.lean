@@ -0,0 +1,21 @@
+-- full extraction shares the string
+#guard "hello world".extract 0 ⟨11⟩ == "hello world"
+#guard "hello world".extract 0 ⟨100⟩ == "hello world"
+#guard ("hello world".extract ⟨6⟩ ⟨11⟩).length == 5
+#guard "hello world".extract ⟨2⟩ ⟨5⟩ == "llo"
+#guard "abc".extract ⟨3⟩ ⟨3⟩ == ""
+-- non-ASCII strings
+#guard ("héllo ∀x".extract 0 ⟨3⟩).length == 2
+#guard ("héllo ∀x".extract ⟨1⟩ ⟨12⟩).length == 7
+#guard "héllo ∀x".extract ⟨2⟩ ⟨12⟩ == ""
+#guard ("  ∀ x  ".trim).length == 3
+#guard "abc".toSubstring.toString == "abc"
+
+-- extracting a whole string returns the string itself instead of a copy
+unsafe def extractShares (s : String) (b e : String.Pos) : Bool :=
+  ptrAddrUnsafe (s.extract b e) == ptrAddrUnsafe s
+
+/-- info: (true, true, true, false) -/
+#guard_msgs in
+#eval let s := "".pushn 'a' 100; (extractShares s 0 s.endPos, extractShares s 0 ⟨1000⟩,
+  extractShares (s.push '∀') 0 ⟨103⟩, extractShares s 0 ⟨99⟩)
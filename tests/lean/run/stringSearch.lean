@@ -0,0 +1,23 @@
+#guard "abcabc".findStr "bc" == ⟨1⟩
+#guard "abcabc".findStr "bc" ⟨2⟩ == ⟨4⟩
+#guard "abcabc".findStr "cb" == ⟨6⟩
+#guard "abcabc".findStr "" ⟨3⟩ == ⟨3⟩
+#guard "abc".findStr "abcd" == ⟨3⟩
+#guard "abc".findStr "c" ⟨10⟩ == ⟨3⟩
+#guard "a∀b∀c".findStr "∀c" == ⟨5⟩
+#guard "aaab".findStr "aab" == ⟨1⟩
+
+#guard "a∀b∀∀c a".countChar '∀' == 3
+#guard "a∀b∀∀c a".countChar 'a' == 2
+#guard "".countChar 'a' == 0
+
+#guard "ababacabac".replace "aba" "X" == "XbacXc"
+#guard "here is some text".replace " " "" == "hereissometext"
+#guard "a∀b∀∀c".replace "∀" "--" == "a--b----c"
+#guard "abc".replace "" "X" == "abc"
+#guard "aaa".replace "aa" "b" == "ba"
+
+#guard ("hello".toUTF8.indexOf? 'l'.toNat.toUInt8) == some 2
+#guard ("hello".toUTF8.indexOf? 'l'.toNat.toUInt8 3) == some 3
+#guard ("hello".toUTF8.indexOf? 'z'.toNat.toUInt8) == none
+#guard ("hello".toUTF8.indexOf? 'o'.toNat.toUInt8 9) == none
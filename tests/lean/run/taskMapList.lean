@@ -0,0 +1,30 @@
+def slowTask (i : Nat) : BaseIO (Task Nat) :=
+  BaseIO.asTask (prio := .dedicated) do
+    IO.sleep (UInt32.ofNat (i % 5))
+    return i
+
+def testMapList : IO Unit := do
+  let ts ← (List.range 100).mapM slowTask
+  let t := Task.mapList (fun vs => vs.foldl (· + ·) 0) ts
+  unless t.get == 4950 do
+    throw <| IO.userError s!"unexpected sum {t.get}"
+  -- all tasks finished, result is computed synchronously
+  let t := Task.mapList (·.reverse) ts (sync := true)
+  unless t.get == (List.range 100).reverse do
+    throw <| IO.userError "unexpected order"
+  let t := Task.mapList (·.length) ([] : List (Task Nat))
+  unless t.get == 0 do
+    throw <| IO.userError "unexpected result for empty list"
+
+def testMapTasks : IO Unit := do
+  let ts ← (List.range 100).mapM slowTask
+  let t ← IO.mapTasks (fun vs => return vs.foldl (· + ·) 0) ts
+  unless (← IO.ofExcept t.get) == 4950 do
+    throw <| IO.userError "unexpected sum"
+  let t ← IO.mapTasks (fun (_ : List Nat) => throw (IO.userError "expected")) ts
+  match t.get with
+  | .error e => unless toString e == "expected" do throw e
+  | .ok _ => throw <| IO.userError "error was not propagated"
+
+#eval testMapList
+#eval testMapTasks